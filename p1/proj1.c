@@ -4,38 +4,68 @@
  * Description: IAED project 1.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <unistd.h>
 
 /* The maximum number of characters in a task description. */
 #define TASK_DESC_SZ 50
-/* The maximum number of tasks supported. */
+/* The default maximum number of tasks, see TASKS_OPTION. */
 #define MAX_TASK_COUNT 10000
 
 /* The maximum number of characters used in an username. */
 #define USER_NAME_SZ 20
-/* The maximum number of users supported. */
+/* The default maximum number of users, see USERS_OPTION. */
 #define MAX_USER_COUNT 50
 
 /* The maximum number of characters used to describe an activity. */
 #define ACTIVITY_DESC_SZ 20
-/* The maximum number of activities supported. */
+/* The default maximum number of activities, see ACTIVITIES_OPTION. */
 #define MAX_ACTIVITY_COUNT 10
+/* The number of default activities. */
+#define DEFAULT_ACTIVITY_COUNT 3
+
+/* Command line options which change the maximum number of each record. */
+#define TASKS_OPTION "-t"
+#define USERS_OPTION "-u"
+#define ACTIVITIES_OPTION "-a"
+
+/* The number of records in the first block of an arena, a power of two. */
+#define ARENA_FIRST_BLOCK 64
+/* The number of blocks in an arena, enough for more than INT_MAX records. */
+#define ARENA_BLOCK_COUNT 26
+
+/* The number of characters read from stdin at once. */
+#define INPUT_BUFFER_SZ 65536
+/* The number of characters written to stdout at once. */
+#define OUTPUT_BUFFER_SZ 65536
+/* The maximum number of characters in an int, sign included. */
+#define INT_CHARS 11
+
+/* The number of slots in a name table once it first grows, a power of two. */
+#define NAMES_FIRST_CAPACITY 16
+/* The ID returned when a name isn't found. */
+#define NO_ID -1
 
 /* String literals used for the default activities. */
 #define TO_DO_STR "TO DO"
 #define IN_PROGRESS_STR "IN PROGRESS"
 #define DONE_STR "DONE"
-
-/* Formatting string literals. */
-#define TASK_ID_FORMAT "task %d\n"
-#define TASK_DONE_FORMAT "duration=%d slack=%d\n"
-#define TASK_1_FORMAT "%d %.*s #%d %.*s\n"
-#define TASK_2_FORMAT "%d %d %.*s\n"
-#define USER_FORMAT "%.*s\n"
-#define ACTIVITY_FORMAT "%.*s\n"
-#define TIME_FORMAT "%d\n"
+/* IDs of the default activities, which are created in this order. */
+#define TO_DO_ID 0
+#define IN_PROGRESS_ID 1
+#define DONE_ID 2
+
+/* String literals the lines sent to stdout are built from, see PUT_LITERAL. */
+#define TASK_ID_STR "task "
+#define TASK_DURATION_STR " #"
+#define DURATION_STR "duration="
+#define SLACK_STR " slack="
+#define ID_ERROR_STR ": "
 
 /* Error string literals. */
 #define TOO_MANY_TASKS_STR "too many tasks"
@@ -51,9 +81,47 @@
 #define TASK_ALREADY_STARTED_STR "task already started"
 #define INVALID_TIME_STR "invalid time"
 #define INVALID_DURATION_STR "invalid duration"
+#define NO_MEMORY_STR "no memory"
+#define USAGE_STR \
+	"usage: proj1 [-t max tasks] [-u max users] [-a max activities]"
+
+/*
+ * Contains characters read from stdin in blocks of up to INPUT_BUFFER_SZ, which
+ * are parsed by moving a cursor over them, see INPUT_GET and INPUT_PEEK.
+ */
+struct input {
+	/* Characters read from stdin. */
+	char buffer[INPUT_BUFFER_SZ];
+	/* Index of the next character to parse. */
+	int pos;
+	/* Number of characters in the buffer. */
+	int end;
+};
+
+/*
+ * Gets the next character of an input as an unsigned char, or EOF if there
+ * are no more characters. INPUT_GET moves the cursor past the character,
+ * INPUT_PEEK doesn't, and the cursor may then be moved with ++in->pos.
+ */
+#define INPUT_GET(in) ((in)->pos < (in)->end || fill_input(in) ? \
+					   (unsigned char)(in)->buffer[(in)->pos++] : EOF)
+#define INPUT_PEEK(in) ((in)->pos < (in)->end || fill_input(in) ? \
+						(unsigned char)(in)->buffer[(in)->pos] : EOF)
+
+/*
+ * Contains characters sent to stdout which weren't written yet. They are
+ * written once OUTPUT_BUFFER_SZ characters are pending, before the program
+ * waits for input and when it exits, see flush_output.
+ */
+struct output {
+	/* Characters waiting to be written. */
+	char buffer[OUTPUT_BUFFER_SZ];
+	/* Number of characters in the buffer. */
+	int length;
+};
 
-/* Error formatting string literals. */
-#define NO_SUCH_TASK_FORMAT "%d: no such task\n"
+/* There is a single stdout, so its output buffer is kept here. */
+struct output output;
 
 /* Contains information about a task. */
 struct task {
@@ -61,240 +129,733 @@ struct task {
 	int id;
 	/* Task description. */
 	char desc[TASK_DESC_SZ];
-	/* Pointer to user which is responsible for the task. */
-	const char* user;
-	/* Pointer to activity where the task is placed. */
-	const char* activity;
+	/* ID of the user which is responsible for the task, NO_ID if none. */
+	int user;
+	/* ID of the activity where the task is placed. */
+	int activity;
+	/* Node of the task in its activity's tree. */
+	struct node* node;
 	/* Predicted task completion duration. */
 	int duration;
 	/* The time the task started being executed. */
 	int start;
 };
 
+/*
+ * Contains records of a fixed size, which are allocated one at a time and
+ * never freed before the whole arena. Records are stored in blocks, each one
+ * twice as large as the one before it, so records never move once allocated,
+ * and growing only allocates a new block, which takes amortised constant time
+ * per record.
+ */
+struct arena {
+	/* Blocks of records, block k holds ARENA_FIRST_BLOCK << k records. */
+	char* blocks[ARENA_BLOCK_COUNT];
+	/* Size of each record in bytes. */
+	size_t size;
+	/* Number of records allocated. */
+	int count;
+};
+
+/* A node of a tree of tasks, see struct tree. */
+struct node {
+	/* Task in the node. */
+	struct task* task;
+	/* Subtrees with the tasks which come before and after the node's. */
+	struct node* left;
+	struct node* right;
+	/* Height of the subtree rooted at the node, 1 for a leaf. */
+	int height;
+};
+
+/* Compares two tasks, returning a negative value if lhs comes first. */
+typedef int (*task_cmp)(const struct task* lhs, const struct task* rhs);
+
+/* Function called on each task traversed by traverse_nodes. */
+typedef void (*task_fn)(void* ptr, struct task* task);
+
+/*
+ * Contains tasks sorted by a comparison function, in an AVL tree. Tasks are
+ * found and inserted in O(log n) and traversed in order in O(n).
+ */
+struct tree {
+	/* Root of the tree, NULL if it is empty. */
+	struct node* root;
+	/* Function which sorts the tasks. */
+	task_cmp cmp;
+};
+
+/*
+ * Maps names to IDs, in a hash table with linear probing. Each name is at the
+ * start of a record of an arena, and its ID is the index of the record. The
+ * table is never more than half full, so lookups take O(1) time on average.
+ */
+struct names {
+	/* Arena with the named records. */
+	struct arena* records;
+	/* Maximum number of characters in a name. */
+	int size;
+	/* Slots holding the ID of a record plus one, 0 if empty. */
+	int* slots;
+	/* Number of slots, a power of two, or 0 if no slots were allocated. */
+	int capacity;
+};
+
+/* Contains information about an activity. */
+struct activity {
+	/* Activity description. */
+	char desc[ACTIVITY_DESC_SZ];
+	/* Tasks in the activity, sorted by starting time and then description. */
+	struct tree tasks;
+};
+
 /* Contains information about a kanban board. */
 struct kanban {
-	/* Tasks in the kanban board, always sorted by description. */
-	struct task tasks[MAX_TASK_COUNT];
+	/* Task records, stored by ID (the first task has ID 1). */
+	struct arena tasks;
+	/* Tasks in the kanban board, sorted by description. */
+	struct tree by_desc;
+	/* Nodes of the trees of tasks, two for each task. */
+	struct arena nodes;
 	/* Number of tasks in the kanban board. */
 	int task_count;
+	/* Maximum number of tasks in the kanban board. */
+	int max_tasks;
 	/* The current time. */
 	int time;
-	/* Users in the kanban board. */
-	char users[MAX_USER_COUNT][USER_NAME_SZ];
-	/* Activities in the kanban board. */
-	char activities[MAX_ACTIVITY_COUNT][ACTIVITY_DESC_SZ];
-	/* Auxiliary array used to sort printed tasks in an activity. */
-	int activity_order[MAX_TASK_COUNT];
+	/* Users in the kanban board, in creation order. */
+	struct arena users;
+	/* Maps user names to their IDs. */
+	struct names user_ids;
+	/* Maximum number of users in the kanban board. */
+	int max_users;
+	/* Activities in the kanban board, in creation order. */
+	struct arena activities;
+	/* Maps activity descriptions to their IDs. */
+	struct names activity_ids;
+	/* Maximum number of activities in the kanban board. */
+	int max_activities;
 };
 
-/* Initializes a kanban board. */
-void init_kanban(struct kanban* board) {
+/* Initializes an input with no characters read yet. */
+void init_input(struct input* in) {
+	in->pos = 0;
+	in->end = 0;
+}
+
+/* Writes every character sent to stdout which wasn't written yet. */
+void flush_output(void) {
+	const char* buffer = output.buffer;
+	ssize_t written;
+
+	/* Retry on partial writes. */
+	while (output.length > 0) {
+		if ((written = write(STDOUT_FILENO, buffer, output.length)) < 0)
+			break; /* Nothing can be done if stdout fails. */
+		buffer += written;
+		output.length -= written;
+	}
+
+	output.length = 0;
+}
+
+/* Sends count characters to stdout. */
+void put_chars(const char* chars, int count) {
+	int chunk;
+
+	while (count > 0) {
+		chunk = OUTPUT_BUFFER_SZ - output.length;
+		if (chunk > count)
+			chunk = count;
+		memcpy(output.buffer + output.length, chars, chunk);
+		output.length += chunk;
+		chars += chunk;
+		count -= chunk;
+
+		if (output.length == OUTPUT_BUFFER_SZ)
+			flush_output();
+	}
+}
+
+/* Sends a string literal to stdout, without counting its characters. */
+#define PUT_LITERAL(str) put_chars(str, sizeof(str) - 1)
+
+/* Sends a character to stdout. */
+void put_char(char c) {
+	output.buffer[output.length++] = c;
+	if (output.length == OUTPUT_BUFFER_SZ)
+		flush_output();
+}
+
+/* Sends a string with up to size characters to stdout, like "%.*s". */
+void put_str(const char* str, int size) {
+	const char* end = memchr(str, '\0', size);
+	put_chars(str, end == NULL ? size : end - str);
+}
+
+/* Sends a string and a newline to stdout, like puts. */
+void put_line(const char* str) {
+	put_chars(str, strlen(str));
+	put_char('\n');
+}
+
+/* Sends an integer to stdout, like "%d". */
+void put_int(int value) {
+	char digits[INT_CHARS];
+	int i = INT_CHARS;
+	/* Converted to unsigned first, so that INT_MIN is negated correctly. */
+	unsigned int n = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+	/* Write the digits from the last one. */
+	do
+		digits[--i] = '0' + n % 10;
+	while ((n /= 10) != 0);
+	if (value < 0)
+		digits[--i] = '-';
+
+	put_chars(digits + i, INT_CHARS - i);
+}
+
+/*
+ * Reads the next block of characters from stdin into an input whose characters
+ * were all parsed. Only the characters already available are waited for, so
+ * commands typed or piped in are executed as soon as their line arrives, and
+ * the output of the commands before is written first.
+ * Returns 0 if there are no more characters, otherwise returns 1.
+ */
+int fill_input(struct input* in) {
+	ssize_t count;
+
+	flush_output();
+	count = read(STDIN_FILENO, in->buffer, INPUT_BUFFER_SZ);
+
+	in->pos = 0;
+	in->end = count > 0 ? count : 0; /* Errors end the input. */
+	return in->end > 0;
+}
+
+/* Initializes an empty arena of records with size bytes each. */
+void init_arena(struct arena* arena, size_t size) {
 	int i;
-	
+
+	for (i = 0; i < ARENA_BLOCK_COUNT; ++i)
+		arena->blocks[i] = NULL;
+	arena->size = size;
+	arena->count = 0;
+}
+
+/* Frees all memory associated with an arena. */
+void free_arena(struct arena* arena) {
+	int i;
+
+	for (i = 0; i < ARENA_BLOCK_COUNT; ++i)
+		free(arena->blocks[i]);
+	init_arena(arena, arena->size);
+}
+
+/*
+ * Gets the block where the record with an index is stored, and sets *offset
+ * to the index of the record within the block.
+ */
+int arena_block(int index, int* offset) {
+	unsigned int n = (unsigned int)index / ARENA_FIRST_BLOCK + 1;
+	int block = 0;
+
+	/* Block k starts at index ARENA_FIRST_BLOCK * (2^k - 1). */
+	while (n >>= 1)
+		++block;
+	*offset = index - ARENA_FIRST_BLOCK * ((1 << block) - 1);
+	return block;
+}
+
+/* Gets a pointer to the record with an index, which must be allocated. */
+void* arena_get(struct arena* arena, int index) {
+	int offset, block = arena_block(index, &offset);
+	return arena->blocks[block] + offset * arena->size;
+}
+
+/*
+ * Allocates a new record at the end of an arena.
+ * Returns NULL if the memory allocation failed, otherwise returns a pointer to
+ * the record.
+ */
+void* arena_alloc(struct arena* arena) {
+	int offset, block = arena_block(arena->count, &offset);
+
+	if (block == ARENA_BLOCK_COUNT)
+		return NULL; /* The arena is full. */
+	if (arena->blocks[block] == NULL &&
+		(arena->blocks[block] =
+		 malloc(((size_t)ARENA_FIRST_BLOCK << block) * arena->size)) == NULL)
+		return NULL; /* Allocation failed. */
+
+	++arena->count;
+	return arena->blocks[block] + offset * arena->size;
+}
+
+/*
+ * Copies a string with up to size characters to a new record of an arena.
+ * Returns 0 if the memory allocation failed, otherwise returns 1.
+ */
+int arena_add_str(struct arena* arena, const char* str, int size) {
+	char* record = arena_alloc(arena);
+
+	if (record == NULL)
+		return 0;
+	strncpy(record, str, size);
+	return 1;
+}
+
+/* Initializes an empty table of the names of the records of an arena. */
+void init_names(struct names* names, struct arena* records, int size) {
+	names->records = records;
+	names->size = size;
+	names->slots = NULL;
+	names->capacity = 0;
+}
+
+/* Frees all memory associated with a name table. */
+void free_names(struct names* names) {
+	free(names->slots);
+}
+
+/* Hashes a name with up to size characters. */
+unsigned int hash_name(const char* name, int size) {
+	unsigned int hash = 0;
+	int i;
+
+	for (i = 0; i < size && name[i] != '\0'; ++i)
+		hash = 31 * hash + (unsigned char)name[i];
+
+	return hash;
+}
+
+/*
+ * Finds the slot of a name in a table with slots allocated.
+ * Returns the slot holding the name's ID, or the empty slot where it belongs.
+ */
+int* find_slot(struct names* names, const char* name) {
+	unsigned int mask = names->capacity - 1;
+	unsigned int i = hash_name(name, names->size) & mask;
+	int* slot;
+
+	/* Probe the slots after the name's hash until an empty one. */
+	for (; *(slot = &names->slots[i]) != 0; i = (i + 1) & mask)
+		if (strncmp(arena_get(names->records, *slot - 1), name,
+					names->size) == 0)
+			break;
+
+	return slot;
+}
+
+/*
+ * Gets the ID of a name in a table.
+ * Returns NO_ID if the name isn't found.
+ */
+int find_name(struct names* names, const char* name) {
+	if (names->capacity == 0)
+		return NO_ID;
+
+	return *find_slot(names, name) - 1;
+}
+
+/*
+ * Makes room in a name table for one more record, which must be added to the
+ * arena before insert_name is called.
+ * Returns 0 if the memory allocation failed, otherwise returns 1.
+ */
+int reserve_name(struct names* names) {
+	int i, count = names->records->count;
+	int* slots = names->slots;
+	int capacity = names->capacity;
+
+	if (2 * (count + 1) <= capacity)
+		return 1; /* There is room already. */
+
+	/* Double the number of slots and insert every name again. */
+	names->capacity = capacity == 0 ? NAMES_FIRST_CAPACITY : 2 * capacity;
+	if ((names->slots = calloc(names->capacity, sizeof(int))) == NULL) {
+		names->slots = slots;
+		names->capacity = capacity;
+		return 0;
+	}
+	for (i = 0; i < count; ++i)
+		*find_slot(names, arena_get(names->records, i)) = i + 1;
+
+	free(slots);
+	return 1;
+}
+
+/* Inserts the name of a record with an ID, for which room was reserved. */
+void insert_name(struct names* names, int id) {
+	*find_slot(names, arena_get(names->records, id)) = id + 1;
+}
+
+/* Returns the height of a subtree, 0 if it is empty. */
+int node_height(struct node* node) {
+	return node == NULL ? 0 : node->height;
+}
+
+/* Recomputes the height of a node from the heights of its subtrees. */
+void update_height(struct node* node) {
+	int left = node_height(node->left), right = node_height(node->right);
+	node->height = (left > right ? left : right) + 1;
+}
+
+/* Rotates a subtree to the right. Returns its new root. */
+struct node* rotate_right(struct node* node) {
+	struct node* left = node->left;
+
+	node->left = left->right;
+	left->right = node;
+	update_height(node);
+	update_height(left);
+	return left;
+}
+
+/* Rotates a subtree to the left. Returns its new root. */
+struct node* rotate_left(struct node* node) {
+	struct node* right = node->right;
+
+	node->right = right->left;
+	right->left = node;
+	update_height(node);
+	update_height(right);
+	return right;
+}
+
+/*
+ * Restores the balance of a subtree after one of its subtrees, which are
+ * balanced, grew or shrank by one. Returns its new root.
+ */
+struct node* balance_node(struct node* node) {
+	int balance = node_height(node->left) - node_height(node->right);
+
+	if (balance > 1) { /* Left subtree is too high. */
+		if (node_height(node->left->left) < node_height(node->left->right))
+			node->left = rotate_left(node->left);
+		return rotate_right(node);
+	}
+	if (balance < -1) { /* Right subtree is too high. */
+		if (node_height(node->right->right) < node_height(node->right->left))
+			node->right = rotate_right(node->right);
+		return rotate_left(node);
+	}
+
+	update_height(node);
+	return node;
+}
+
+/* Inserts a node in a subtree sorted by cmp. Returns its new root. */
+struct node* insert_node(struct node* root, struct node* node, task_cmp cmp) {
+	if (root == NULL)
+		return node;
+
+	if (cmp(node->task, root->task) < 0)
+		root->left = insert_node(root->left, node, cmp);
+	else
+		root->right = insert_node(root->right, node, cmp);
+	return balance_node(root);
+}
+
+/* Inserts a task in a tree, using a node allocated by the caller. */
+void tree_insert(struct tree* tree, struct node* node, struct task* task) {
+	node->task = task;
+	node->left = node->right = NULL;
+	node->height = 1;
+	tree->root = insert_node(tree->root, node, tree->cmp);
+}
+
+/*
+ * Removes the first node of a non empty subtree, which is stored on min.
+ * Returns its new root.
+ */
+struct node* remove_min(struct node* root, struct node** min) {
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+
+	root->left = remove_min(root->left, min);
+	return balance_node(root);
+}
+
+/*
+ * Removes the node of a task, which must be in a subtree sorted by cmp.
+ * Returns its new root.
+ */
+struct node* remove_node(struct node* root, struct task* task, task_cmp cmp) {
+	struct node* min;
+	int order = cmp(task, root->task);
+
+	if (order < 0)
+		root->left = remove_node(root->left, task, cmp);
+	else if (order > 0)
+		root->right = remove_node(root->right, task, cmp);
+	else if (root->right == NULL)
+		return root->left;
+	else { /* The next node takes the place of the removed one. */
+		root->right = remove_min(root->right, &min);
+		min->left = root->left;
+		min->right = root->right;
+		root = min;
+	}
+
+	return balance_node(root);
+}
+
+/*
+ * Removes a task from a tree. The task must be in the tree and its fields used
+ * by the comparison function must not have changed since it was inserted. Its
+ * node may then be inserted again.
+ */
+void tree_remove(struct tree* tree, struct task* task) {
+	tree->root = remove_node(tree->root, task, tree->cmp);
+}
+
+/* Calls fn(ptr, task) on every task in a subtree, in order. */
+void traverse_nodes(struct node* node, void* ptr, task_fn fn) {
+	for (; node != NULL; node = node->right) {
+		traverse_nodes(node->left, ptr, fn);
+		fn(ptr, node->task);
+	}
+}
+
+/* Compares two tasks by description. */
+int compare_desc(const struct task* lhs, const struct task* rhs) {
+	return strncmp(lhs->desc, rhs->desc, TASK_DESC_SZ);
+}
+
+/* Compares two tasks by starting time and then by description. */
+int compare_start(const struct task* lhs, const struct task* rhs) {
+	if (lhs->start != rhs->start)
+		return lhs->start < rhs->start ? -1 : 1;
+	return compare_desc(lhs, rhs);
+}
+
+/*
+ * Adds an activity with no tasks to a kanban board, with the next ID.
+ * Returns 0 if the memory allocation failed, otherwise returns 1.
+ */
+int alloc_activity(struct kanban* board, const char* desc) {
+	struct activity* activity;
+
+	if (!reserve_name(&board->activity_ids) ||
+		(activity = arena_alloc(&board->activities)) == NULL)
+		return 0;
+
+	strncpy(activity->desc, desc, ACTIVITY_DESC_SZ);
+	activity->tasks.root = NULL;
+	activity->tasks.cmp = &compare_start;
+	insert_name(&board->activity_ids, board->activities.count - 1);
+	return 1;
+}
+
+/*
+ * Initializes a kanban board, which holds up to the maximum number of tasks,
+ * users and activities passed.
+ * Returns 0 if the memory allocation failed, otherwise returns 1.
+ */
+int init_kanban(struct kanban* board, int max_tasks, int max_users,
+				int max_activities) {
+	init_arena(&board->tasks, sizeof(struct task));
+	board->by_desc.root = NULL;
+	board->by_desc.cmp = &compare_desc;
+	init_arena(&board->nodes, sizeof(struct node));
 	board->task_count = 0;
+	board->max_tasks = max_tasks;
 	board->time = 0;
+	init_arena(&board->users, USER_NAME_SZ);
+	init_names(&board->user_ids, &board->users, USER_NAME_SZ);
+	board->max_users = max_users;
+	init_arena(&board->activities, sizeof(struct activity));
+	init_names(&board->activity_ids, &board->activities, ACTIVITY_DESC_SZ);
+	board->max_activities = max_activities;
+
+	/* Set default activities, in the order of their IDs. */
+	return alloc_activity(board, TO_DO_STR) &&
+		   alloc_activity(board, IN_PROGRESS_STR) &&
+		   alloc_activity(board, DONE_STR);
+}
+
+/* Frees all memory associated with a kanban board. */
+void free_kanban(struct kanban* board) {
+	free_arena(&board->tasks);
+	free_arena(&board->nodes);
+	free_arena(&board->users);
+	free_names(&board->user_ids);
+	free_arena(&board->activities);
+	free_names(&board->activity_ids);
+}
+
+/* Gets a pointer to the task with an index, in ID order. */
+struct task* get_task(struct kanban* board, int index) {
+	return arena_get(&board->tasks, index);
+}
 
-	for (i = 0; i < MAX_USER_COUNT; ++i)
-		board->users[i][0] = '\0';
+/* Gets a pointer to the user with an ID, its index in creation order. */
+char* get_user(struct kanban* board, int index) {
+	return arena_get(&board->users, index);
+}
 
-	/* Set default activities. */
-	strncpy(board->activities[0], TO_DO_STR, ACTIVITY_DESC_SZ);
-	strncpy(board->activities[1], IN_PROGRESS_STR, ACTIVITY_DESC_SZ);
-	strncpy(board->activities[2], DONE_STR, ACTIVITY_DESC_SZ);
-	for (i = 3; i < MAX_ACTIVITY_COUNT; ++i)
-		board->activities[i][0] = '\0';
+/* Gets a pointer to the activity with an ID, its index in creation order. */
+struct activity* get_activity(struct kanban* board, int index) {
+	return arena_get(&board->activities, index);
 }
 
-/* Initializes a task. */
+/* Initializes a task, placed in the activity TO_DO_STR. */
 void init_task(struct task* task, int id, int duration, const char* desc) {
 	task->id = id;
 	strncpy(task->desc, desc, TASK_DESC_SZ);
-	task->user = NULL;
-	task->activity = TO_DO_STR;
+	task->user = NO_ID;
+	task->activity = TO_DO_ID;
 	task->start = 0;
 	task->duration = duration;
 }
 
 /*
- * Gets a pointer to a user string on a board.
- * Returns NULL if the user isn't found.
+ * Gets the ID of a user on a board.
+ * Returns NO_ID if the user isn't found.
  */
-const char* find_user(struct kanban* board, const char* name) {
-	int i;
-
-	for (i = 0; board->users[i][0] != '\0' && i < MAX_USER_COUNT; ++i)
-		if (strncmp(board->users[i], name, USER_NAME_SZ) == 0)
-			return board->users[i];
-
-	return NULL;
+int find_user(struct kanban* board, const char* name) {
+	return find_name(&board->user_ids, name);
 }
 
 /*
- * Gets a pointer to an activity on a board.
- * Returns NULL if the activity isn't found.
+ * Gets the ID of an activity on a board.
+ * Returns NO_ID if the activity isn't found.
  */
-const char* find_activity(struct kanban* board, const char* activity) {
-	int i;
-
-	for (i = 0; board->activities[i][0] != '\0' && i < MAX_ACTIVITY_COUNT; ++i)
-		if (strncmp(board->activities[i], activity, ACTIVITY_DESC_SZ) == 0)
-			return board->activities[i];
-
-	return NULL;
+int find_activity(struct kanban* board, const char* activity) {
+	return find_name(&board->activity_ids, activity);
 }
 
 /*
  * Gets a pointer to a task from its id.
  * Returns NULL if the task isn't found.
+ *
+ * IDs are given in sequence starting at 1 and task records are stored by ID,
+ * so the task is found directly in its arena, without a search.
  */
 struct task* find_task(struct kanban* board, int id) {
-	int i;
-	
-	for (i = 0; i < board->task_count; ++i)
-		if (board->tasks[i].id == id)
-			return &board->tasks[i];
+	if (id < 1 || id > board->task_count)
+		return NULL;
 
-	return NULL;
+	return get_task(board, id - 1);
 }
 
-/* Prints a task with the format TASK_1_FORMAT. */
-void print_task_1(struct task* task) {
-	printf(
-		TASK_1_FORMAT,
-		task->id,
-		ACTIVITY_DESC_SZ, task->activity,
-		task->duration,
-		TASK_DESC_SZ, task->desc
-	);
+/* Prints a task on a board as "<id> <activity> #<duration> <description>". */
+void print_task_1(struct kanban* board, struct task* task) {
+	put_int(task->id);
+	put_char(' ');
+	put_str(get_activity(board, task->activity)->desc, ACTIVITY_DESC_SZ);
+	PUT_LITERAL(TASK_DURATION_STR);
+	put_int(task->duration);
+	put_char(' ');
+	put_str(task->desc, TASK_DESC_SZ);
+	put_char('\n');
 }
 
-/* Prints a task with the format TASK_2_FORMAT. */
+/* Prints a task as "<id> <start> <description>". */
 void print_task_2(struct task* task) {
-	printf(
-		TASK_2_FORMAT,
-		task->id,
-		task->start,
-		TASK_DESC_SZ, task->desc
-	);
+	put_int(task->id);
+	put_char(' ');
+	put_int(task->start);
+	put_char(' ');
+	put_str(task->desc, TASK_DESC_SZ);
+	put_char('\n');
+}
+
+/* Auxiliar function to list_all_tasks, prints each task traversed. */
+void print_task_aux(void* board, struct task* task) {
+	print_task_1(board, task);
 }
 
 /*
  * Print all of the tasks in the board in lexicographical order.
- * The tasks are printed with the format TASK_1_FORMAT.
+ * The tasks are printed as in print_task_1.
  */
 void list_all_tasks(struct kanban* board) {
-	int i;
-
 	/*
 	 * Since the tasks are always sorted by their description, no sorting
 	 * is necessary here. 
 	 */
-	for (i = 0; i < board->task_count; ++i)
-		print_task_1(&board->tasks[i]);
-}
-
-/*
- * Sorts the indexes of the tasks stored on board->activity_order by starting
- * time. If two tasks have the same starting time, the task which is
- * lexicographically smaller appears first.
- */
-void sort_activity_tasks(struct kanban* board, int count) {
-	int i, changed, temp;
-	int* order = board->activity_order;
-	struct task* lhs;
-	struct task* rhs;
-
-	/* Bubble sort the indexes of the tasks. */
-	do {
-		changed = 0;
-		for (i = 1; i < count; ++i) {
-			lhs = &board->tasks[order[i - 1]];
-			rhs = &board->tasks[order[i]];
-			/* If the task indexes are unordered. */
-			if (lhs->start > rhs->start ||
-				(lhs->start == rhs->start && order[i - 1] > order[i])) {
-				/* Swap task indexes. */
-				temp = order[i];
-				order[i] = order[i - 1];
-				order[i - 1] = temp;
-				changed = 1;
-			}
-		}
-	} while (changed);
+	traverse_nodes(board->by_desc.root, board, &print_task_aux);
+}
+
+/* Auxiliar function to list_activity_tasks, prints each task traversed. */
+void print_task_2_aux(void* unused, struct task* task) {
+	(void)unused; /* Supress unused parameter warning. */
+	print_task_2(task);
 }
 
 /*
  * Print all of the tasks in an activity sorted by starting time. If two tasks
  * have the same starting time, the task which is lexicographically smaller
  * appears first.
- * The tasks are printed with the format TASK_2_FORMAT.
+ * The tasks are printed as in print_task_2.
  *
  * If the activity isn't on the board, NO_SUCH_ACTIVITY_STR is sent to stdout
  * and the operation is canceled.
  */
 void list_activity_tasks(struct kanban* board, const char* activity) {
-	int i, count = 0;
-	int* order = board->activity_order;
+	int id = find_activity(board, activity);
 
 	/* Check if the activity exists. */
-	if (find_activity(board, activity) == NULL) {
-		puts(NO_SUCH_ACTIVITY_STR);
+	if (id == NO_ID) {
+		put_line(NO_SUCH_ACTIVITY_STR);
 		return;
 	}
 
-	/* Search for tasks which are in the activity. */
-	for (i = 0; i < board->task_count; ++i)
-		if (strncmp(board->tasks[i].activity, activity, ACTIVITY_DESC_SZ) == 0)
-			order[count++] = i;
-
-	/* Sort the indexes of the tasks in the activity. */
-	sort_activity_tasks(board, count);
-	
-	/* Print tasks in the activity. */
-	for (i = 0; i < count; ++i)
-		print_task_2(&board->tasks[order[i]]);
+	/*
+	 * Since each activity keeps its tasks sorted by starting time and
+	 * description, no sorting is necessary here.
+	 */
+	traverse_nodes(get_activity(board, id)->tasks.root, NULL,
+				   &print_task_2_aux);
 }
 
 /*
  * Print all of the users in creation order.
- * The users are printed with the format USER_FORMAT.
+ * Each user is printed on its own line.
  */
 void list_users(struct kanban* board) {
 	int i;
 
-	for (i = 0; board->users[i][0] != '\0' && i < MAX_USER_COUNT; ++i)
-		printf(USER_FORMAT, USER_NAME_SZ, board->users[i]);
+	for (i = 0; i < board->users.count; ++i) {
+		put_str(get_user(board, i), USER_NAME_SZ);
+		put_char('\n');
+	}
 }
 
 /*
  * Print all of the activities in creation order.
- * The activities are printed with the format ACTIVITY_FORMAT.
+ * Each activity is printed on its own line.
  */
 void list_activities(struct kanban* board) {
 	int i;
 	
-	for (i = 0; board->activities[i][0] != '\0' && i < MAX_ACTIVITY_COUNT; ++i)
-		printf(ACTIVITY_FORMAT, ACTIVITY_DESC_SZ, board->activities[i]);
+	for (i = 0; i < board->activities.count; ++i) {
+		put_str(get_activity(board, i)->desc, ACTIVITY_DESC_SZ);
+		put_char('\n');
+	}
 }
 
 /*
- * Returns the index of the first task which has a lexigraphically larger
- * description than the one passed as argument. If no task is found,
- * board->task_count is returned.
- * If a task with the same description is found, -1 is returned.
+ * Gets a pointer to a task from its description.
+ * Returns NULL if the task isn't found.
  */
-int search_task_index(struct kanban* board, const char* desc) {
-	int i = 0, cmp;
-
-	for (i = 0; i < board->task_count; ++i) {
-		cmp = strncmp(board->tasks[i].desc, desc, TASK_DESC_SZ);
-		if (cmp > 0)
-			return i; /* Found index, return it. */
-		else if (cmp == 0)
-			return -1; /* Duplicate description. */
+struct task* find_task_by_desc(struct kanban* board, const char* desc) {
+	struct node* node = board->by_desc.root;
+	int cmp;
+
+	/* Go down the tree, towards where the description would be. */
+	while (node != NULL) {
+		if ((cmp = strncmp(desc, node->task->desc, TASK_DESC_SZ)) == 0)
+			return node->task;
+		node = cmp < 0 ? node->left : node->right;
 	}
 
-	return board->task_count; /* No task found. */
+	return NULL;
 }
 
 /*
@@ -306,28 +867,38 @@ int search_task_index(struct kanban* board, const char* desc) {
  * DUPLICATE_DESC_STR is sent to stdout and the operation is canceled.
  * Otherwise, if the duration isn't a positive integer, INVALID_DURATION_STR is
  * sent to stdout and the operation is canceled.
- * Otherwise, TASK_ID_FORMAT is sent to stdout formatted with the new task ID.
+ * Otherwise, if the memory allocation fails, NO_MEMORY_STR is sent to stdout
+ * and the operation is canceled.
+ * Otherwise, TASK_ID_STR followed by the new task ID is sent to stdout.
  * 
- * The task array is always sorted, so we need to find where to insert a
- * new element. This could be done using binary search, but since we're
- * going to have to move the array forward it will be O(N) anyway (assuming
- * memmove is O(N)). So, a simple linear search will suffice.
+ * Task records are stored by ID and never moved. The tree sorted by
+ * description finds duplicates and inserts the task in O(log N), as does the
+ * tree of the activity the task is placed in.
  */
 void add_task(struct kanban* board, int duration, const char* desc) {
-	int i = -1;
+	struct node* desc_node;
+	struct node* activity_node;
+	struct task* task;
 
-	if (board->task_count == MAX_TASK_COUNT) /* Check for too many tasks. */
-		puts(TOO_MANY_TASKS_STR);
-	else if ((i = search_task_index(board, desc)) == -1) /* If duplicate. */
-		puts(DUPLICATE_DESC_STR);
+	if (board->task_count == board->max_tasks) /* Check for too many tasks. */
+		put_line(TOO_MANY_TASKS_STR);
+	else if (find_task_by_desc(board, desc) != NULL) /* If duplicate. */
+		put_line(DUPLICATE_DESC_STR);
 	else if (duration <= 0) /* Check if the duration is valid. */
-		puts(INVALID_DURATION_STR);
+		put_line(INVALID_DURATION_STR);
+	else if ((desc_node = arena_alloc(&board->nodes)) == NULL ||
+			 (activity_node = arena_alloc(&board->nodes)) == NULL ||
+			 (task = arena_alloc(&board->tasks)) == NULL)
+		put_line(NO_MEMORY_STR); /* Nodes already allocated are left unused. */
 	else {
-		if (i != board->task_count) /* Move array for new task. */
-			memmove(&board->tasks[i + 1], &board->tasks[i],
-					(board->task_count - i) * sizeof(struct task));
-		init_task(&board->tasks[i], ++board->task_count, duration, desc);
-		printf(TASK_ID_FORMAT, board->task_count);
+		init_task(task, ++board->task_count, duration, desc);
+		tree_insert(&board->by_desc, desc_node, task);
+		task->node = activity_node;
+		tree_insert(&get_activity(board, task->activity)->tasks, task->node,
+					task);
+		PUT_LITERAL(TASK_ID_STR);
+		put_int(board->task_count);
+		put_char('\n');
 	}
 }
 
@@ -338,22 +909,19 @@ void add_task(struct kanban* board, int duration, const char* desc) {
  * stdout and the operation is canceled.
  * Otherwise, if the board is already full of users, TOO_MANY_USERS_STR is
  * sent to stdout and the operation is canceled.
+ * Otherwise, if the memory allocation fails, NO_MEMORY_STR is sent to stdout
+ * and the operation is canceled.
  */
 void add_user(struct kanban* board, const char* name) {
-	int i;
-
-	/* Search for an empty slot and check if the name is duplicated. */
-	for (i = 0; board->users[i][0] != '\0' && i < MAX_USER_COUNT; ++i)
-		if (strncmp(board->users[i], name, USER_NAME_SZ) == 0) {
-			puts(USER_ALREADY_EXISTS_STR);
-			return;
-		}
-
-	/* Check if an empty slot was found. */
-	if (i >= MAX_USER_COUNT)
-		puts(TOO_MANY_USERS_STR);
+	if (find_user(board, name) != NO_ID) /* Check if the name is duplicated. */
+		put_line(USER_ALREADY_EXISTS_STR);
+	else if (board->users.count == board->max_users) /* Check if full. */
+		put_line(TOO_MANY_USERS_STR);
+	else if (!reserve_name(&board->user_ids) ||
+			 !arena_add_str(&board->users, name, USER_NAME_SZ))
+		put_line(NO_MEMORY_STR);
 	else
-		strncpy(board->users[i], name, USER_NAME_SZ);
+		insert_name(&board->user_ids, board->users.count - 1);
 }
 
 /*
@@ -365,35 +933,36 @@ void add_user(struct kanban* board, const char* name) {
  * INVALID_DESC_STR is sent to stdout and the operation is canceled.
  * Otherwise, if the board is already full of activities,
  * TOO_MANY_ACTIVITIES_STR is sent to stdout and the operation is canceled.
+ * Otherwise, if the memory allocation fails, NO_MEMORY_STR is sent to stdout
+ * and the operation is canceled.
  */
 void add_activity(struct kanban* board, const char* desc) {
-	int i, j;
+	int j;
 
-	/* Search for an empty slot and check if the name is duplicated. */
-	for (i = 0; board->activities[i][0] != '\0' && i < MAX_ACTIVITY_COUNT; ++i)
-		if (strncmp(board->activities[i], desc, ACTIVITY_DESC_SZ) == 0) {
-			puts(DUPLICATE_ACTIVITY_STR);
-			return;
-		}
+	/* Check if the name is duplicated. */
+	if (find_activity(board, desc) != NO_ID) {
+		put_line(DUPLICATE_ACTIVITY_STR);
+		return;
+	}
 
 	/* Check if the activity description is valid. */
 	for (j = 0; j < ACTIVITY_DESC_SZ && desc[j] != '\0'; ++j)
 		if (islower(desc[j])) {
-			puts(INVALID_DESC_STR);
+			put_line(INVALID_DESC_STR);
 			return;
 		}
 
-	if (i >= MAX_ACTIVITY_COUNT) /* Check if an empty slot was found. */
-		puts(TOO_MANY_ACTIVITIES_STR);
-	else
-		strncpy(board->activities[i], desc, ACTIVITY_DESC_SZ);
+	if (board->activities.count == board->max_activities) /* Check if full. */
+		put_line(TOO_MANY_ACTIVITIES_STR);
+	else if (!alloc_activity(board, desc))
+		put_line(NO_MEMORY_STR);
 }
 
 /*
  * Moves a task on a kanban board to another activity.
- * If the task is moved to the activity DONE_STR, TASK_DONE_FORMAT is sent to
- * stdout formatted with the predicted completion time and difference between
- * the real and predicted times.
+ * If the task is moved to the activity DONE_STR, DURATION_STR and SLACK_STR are
+ * sent to stdout followed by the time the task took and the difference between
+ * that time and its predicted duration.
  * 
  * If the task isn't on the board, NO_SUCH_TASK_STR is sent to
  * stdout and the operation is canceled.
@@ -405,58 +974,99 @@ void add_activity(struct kanban* board, const char* desc) {
  * to stdout and the operation is canceled.
  */
 void move_task(struct kanban* b, int id, const char* usr, const char* act) {
+	int user, activity;
 	struct task* task;
 
 	if ((task = find_task(b, id)) == NULL) /* Get task. */
-		puts(NO_SUCH_TASK_STR);
-	else if (strncmp(act, TO_DO_STR, ACTIVITY_DESC_SZ) == 0 &&
-			 strncmp(task->activity, TO_DO_STR, ACTIVITY_DESC_SZ) != 0)
-		puts(TASK_ALREADY_STARTED_STR); /* Task had already been started. */
-	else if ((usr = find_user(b, usr)) == NULL) /* Get user. */
-		puts(NO_SUCH_USER_STR);
-	else if ((act = find_activity(b, act)) == NULL) /* Get activity. */
-		puts(NO_SUCH_ACTIVITY_STR);
+		put_line(NO_SUCH_TASK_STR);
+	else if ((activity = find_activity(b, act)) == TO_DO_ID &&
+			 task->activity != TO_DO_ID)
+		put_line(TASK_ALREADY_STARTED_STR); /* Task had already been started. */
+	else if ((user = find_user(b, usr)) == NO_ID) /* Get user. */
+		put_line(NO_SUCH_USER_STR);
+	else if (activity == NO_ID) /* Check if the activity exists. */
+		put_line(NO_SUCH_ACTIVITY_STR);
 	else {
-		if (strncmp(task->activity, TO_DO_STR, ACTIVITY_DESC_SZ) == 0)
+		/* Take the task out of its activity before its start changes. */
+		tree_remove(&get_activity(b, task->activity)->tasks, task);
+
+		if (task->activity == TO_DO_ID)
 			task->start = b->time; /* Task is being started now. */
 
-		if (strncmp(task->activity, DONE_STR, ACTIVITY_DESC_SZ) != 0 &&
-			strncmp(act, DONE_STR, ACTIVITY_DESC_SZ) == 0) /* Task is done. */
-			printf(TASK_DONE_FORMAT, b->time - task->start,
-									 b->time - task->start - task->duration);
+		/* Task is done. */
+		if (task->activity != DONE_ID && activity == DONE_ID) {
+			PUT_LITERAL(DURATION_STR);
+			put_int(b->time - task->start);
+			PUT_LITERAL(SLACK_STR);
+			put_int(b->time - task->start - task->duration);
+			put_char('\n');
+		}
 
-		task->user = usr;
-		task->activity = act;
+		task->user = user;
+		task->activity = activity;
+		tree_insert(&get_activity(b, activity)->tasks, task->node, task);
 	}
 }
 
 /*
- * Advances time on a kanban board and TIME_FORMAT is sent to stdout formatted
- * with the new current time.
+ * Advances time on a kanban board and the new current time is sent to stdout.
  * 
  * If the duration is negative, INVALID_TIME_STR is sent to
  * stdout and the operation is canceled.
  */
 void advance_time(struct kanban* board, int duration) {
 	if (duration < 0)
-		puts(INVALID_TIME_STR);
+		put_line(INVALID_TIME_STR);
 	else {
 		board->time += duration;
-		printf(TIME_FORMAT, board->time);
+		put_int(board->time);
+		put_char('\n');
 	}	
 }
 
 /*
- * Reads an ID from stdin.
+ * Reads an integer from an input, like scanf("%d"): any whitespace before it,
+ * newlines included, is skipped.
+ * If no integer is found, 0 is stored and returned. Otherwise 1 is returned.
+ */
+int read_int(struct input* in, int* value) {
+	unsigned int n = 0;
+	int c, digits = 0, sign = 1;
+
+	while (isspace(c = INPUT_PEEK(in)))
+		++in->pos;
+
+	if (c == '-' || c == '+') {
+		sign = c == '-' ? -1 : 1;
+		++in->pos;
+	}
+
+	for (; (c = INPUT_PEEK(in)) >= '0' && c <= '9'; ++digits, ++in->pos)
+		n = 10 * n + c - '0';
+
+	*value = sign == -1 ? -(int)n : (int)n;
+	return digits > 0;
+}
+
+/*
+ * Reads an ID from an input.
  * If no ID is found, 0 is returned. Otherwise 1 is returned. 
  */
-int read_id(int* id) {
+int read_id(struct input* in, int* id) {
 	int c, sign = 1;
 	*id = -1;
 
-	/* While a newline or a whitespace after the ID isn't found. */
-	while ((c = getchar()) != '\n' && !(isspace(c) && *id != -1)) {
-		if (c == '-')
+	/*
+	 * While a newline or a whitespace after the ID isn't found. The newline
+	 * isn't consumed, since it is needed for the calling function.
+	 */
+	while ((c = INPUT_PEEK(in)) != '\n' && c != EOF) {
+		++in->pos;
+		if (isspace(c)) {
+			if (*id != -1)
+				break;
+		}
+		else if (c == '-')
 			sign = -1; /* Invalid negative IDs need to be handled. */
 		else if (c >= '0' && c <= '9') {
 			if (*id == -1)
@@ -465,9 +1075,6 @@ int read_id(int* id) {
 		}
 	}
 
-	if (c == '\n') /* The newline is needed for the calling function. */
-		ungetc(c, stdin);
-	
 	if (*id == -1) /* If no ID was read, return 0. */
 		return 0;
 
@@ -476,13 +1083,14 @@ int read_id(int* id) {
 }
 
 /*
- * Reads either a task or activity description from stdin.
+ * Reads either a task or activity description from an input.
  * If no description is found, 0 is returned. Otherwise 1 is returned. 
  */
-int read_desc(char* desc, int size) {
+int read_desc(struct input* in, char* desc, int size) {
 	int c, index = -1;
-	
-	while ((c = getchar()) != '\n') { /* While a newline isn't found. */
+
+	/* While a newline isn't found. */
+	while ((c = INPUT_GET(in)) != '\n' && c != EOF) {
 		if (isspace(c)) {
 			/* Trim whitespace at the beginning of the stream. */
 			if (index != -1 && index < size - 1)
@@ -502,16 +1110,17 @@ int read_desc(char* desc, int size) {
 }
 
 /*
- * Tries to read a username from stdin.
+ * Tries to read a username from an input.
  * If no username is found, 0 is returned. Otherwise 1 is returned. 
  */
-int read_username(char* name, int size) {
+int read_username(struct input* in, char* name, int size) {
 	/* Index of the last character read. */
 	int index = -1;
 	int c;
 
 	/* While a newline isn't found and no whitespace is found after the name. */
-	while ((c = getchar()) != '\n' && !(isspace(c) && index != -1))
+	while ((c = INPUT_GET(in)) != '\n' && c != EOF &&
+		   !(isspace(c) && index != -1))
 		if (!isspace(c) && index < size - 1)
 			name[++index] = c;
 
@@ -527,34 +1136,37 @@ int read_username(char* name, int size) {
  * board.
  * Input format: <duration> <description> 
  */
-void read_t_command(struct kanban* board) {
+void read_t_command(struct kanban* board, struct input* in) {
 	int duration;
 	char desc[TASK_DESC_SZ];
 
-	scanf("%d", &duration);
-	read_desc(desc, TASK_DESC_SZ);
+	read_int(in, &duration);
+	read_desc(in, desc, TASK_DESC_SZ);
 	add_task(board, duration, desc);
 }
 
 /*
  * Reads and executes a 'l' command from stdin, which prints either the tasks
  * passed to it or if none is passed prints all tasks in lexicographical order.
- * If a task is not found from its ID NO_SUCH_TASK_FORMAT is sent to stdout
- * formatted with the ID.
+ * If a task is not found from its ID, the ID is sent to stdout followed by
+ * ID_ERROR_STR and NO_SUCH_TASK_STR.
  * Input format: [<id> <id> ... <id>]
  */
-void read_l_command(struct kanban* board) {
+void read_l_command(struct kanban* board, struct input* in) {
 	int empty = 1, id;
 	struct task* task;
 
 	/* Try to read IDs. */
-	while (read_id(&id)) {
+	while (read_id(in, &id)) {
 		empty = 0;
 		task = find_task(board, id);
-		if (task == NULL)
-			printf(NO_SUCH_TASK_FORMAT, id);
+		if (task == NULL) {
+			put_int(id);
+			PUT_LITERAL(ID_ERROR_STR);
+			put_line(NO_SUCH_TASK_STR);
+		}
 		else
-			print_task_1(task);
+			print_task_1(board, task);
 	}
 
 	/* If no IDs are provided, list all tasks. */
@@ -567,10 +1179,10 @@ void read_l_command(struct kanban* board) {
  * board.
  * Input format: <duration>
  */
-void read_n_command(struct kanban* board) {
+void read_n_command(struct kanban* board, struct input* in) {
 	int duration;
 
-	scanf("%d", &duration);
+	read_int(in, &duration);
 	advance_time(board, duration);
 }
 
@@ -579,10 +1191,10 @@ void read_n_command(struct kanban* board) {
  * the board or prints all of the users in creation order.
  * Input format: [<username>]
  */
-void read_u_command(struct kanban* board) {
+void read_u_command(struct kanban* board, struct input* in) {
 	char name[USER_NAME_SZ];
 
-	if (read_username(name, USER_NAME_SZ))
+	if (read_username(in, name, USER_NAME_SZ))
 		add_user(board, name); /* Add user to board. */
 	else
 		list_users(board); /* Print list of users. */
@@ -593,13 +1205,13 @@ void read_u_command(struct kanban* board) {
  * activity.
  * Input format: <id> <username> <activity>
  */
-void read_m_command(struct kanban* board) {
+void read_m_command(struct kanban* board, struct input* in) {
 	int id;
 	char user[USER_NAME_SZ], activity[ACTIVITY_DESC_SZ];
 
-	scanf("%d", &id);
-	read_username(user, USER_NAME_SZ);
-	read_desc(activity, ACTIVITY_DESC_SZ);
+	read_int(in, &id);
+	read_username(in, user, USER_NAME_SZ);
+	read_desc(in, activity, ACTIVITY_DESC_SZ);
 	move_task(board, id, user, activity);
 }
 
@@ -608,9 +1220,9 @@ void read_m_command(struct kanban* board) {
  * activity.
  * Input format: <activity>
  */
-void read_d_command(struct kanban* board) {
+void read_d_command(struct kanban* board, struct input* in) {
 	char activity[ACTIVITY_DESC_SZ];
-	read_desc(activity, ACTIVITY_DESC_SZ);
+	read_desc(in, activity, ACTIVITY_DESC_SZ);
 	list_activity_tasks(board, activity);
 }
 
@@ -619,61 +1231,98 @@ void read_d_command(struct kanban* board) {
  * to the board or prints all activities on the board.
  * Input format: [<activity>]
  */
-void read_a_command(struct kanban* board) {
+void read_a_command(struct kanban* board, struct input* in) {
 	char desc[ACTIVITY_DESC_SZ];
 
-	if (read_desc(desc, ACTIVITY_DESC_SZ))
+	if (read_desc(in, desc, ACTIVITY_DESC_SZ))
 		add_activity(board, desc); /* Add activity to board. */
 	else
 		list_activities(board); /* Print list of activities. */
 }
 
 /*
- * Tries to read a command from stdin. If the character passed is not a command
- * character, the function doesn't do anything. Otherwise, the respective
- * command is read and executed.
+ * Tries to read a command from an input. If the character passed is not a
+ * command character, the function doesn't do anything. Otherwise, the
+ * respective command is read and executed.
  */
-void read_command(struct kanban* board, int c) {
+void read_command(struct kanban* board, struct input* in, int c) {
 	switch (c) {
 	case 't': /* Adds a task to a board. */
-		read_t_command(board);
+		read_t_command(board, in);
 		break;
 	case 'l': /* Lists tasks. */
-		read_l_command(board);
+		read_l_command(board, in);
 		break;
 	case 'n': /* Advances time. */
-		read_n_command(board);
+		read_n_command(board, in);
 		break;
 	case 'u': /* Add user / list users. */
-		read_u_command(board);
+		read_u_command(board, in);
 		break;
 	case 'm': /* Move task. */
-		read_m_command(board);
+		read_m_command(board, in);
 		break;
 	case 'd': /* List tasks in activity. */
-		read_d_command(board);
+		read_d_command(board, in);
 		break;
 	case 'a': /* Add activity / list actvities. */
-		read_a_command(board);
+		read_a_command(board, in);
 		break;
 	}
 }
 
-/* Reads commands from stdin line by line and executes them. */
-int main() {
-	/*
-		Kanban board, must be static to prevent stack overflow. It could also
-		be declared globally but I decided that I didn't want to pollute the
-		global scope.
-	*/
-	static struct kanban board;
-	int c;
+/*
+ * Parses the command line options, which change the maximum number of tasks,
+ * users and activities on the board. Returns 0 if the options are invalid,
+ * otherwise returns 1.
+ */
+int parse_options(int argc, char* argv[], int* max_tasks, int* max_users,
+				  int* max_activities) {
+	int i;
 
-	init_kanban(&board);
+	*max_tasks = MAX_TASK_COUNT;
+	*max_users = MAX_USER_COUNT;
+	*max_activities = MAX_ACTIVITY_COUNT;
+
+	for (i = 1; i < argc; i += 2) {
+		if (i + 1 == argc)
+			return 0; /* Every option takes a value. */
+		if (strcmp(argv[i], TASKS_OPTION) == 0)
+			*max_tasks = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], USERS_OPTION) == 0)
+			*max_users = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], ACTIVITIES_OPTION) == 0)
+			*max_activities = atoi(argv[i + 1]);
+		else
+			return 0;
+	}
 
-	/* While q isn't entered. */
-	while ((c = getchar()) != 'q')
-		read_command(&board, c);
+	/* The default activities are always on the board. */
+	return *max_tasks >= 0 && *max_users >= 0 &&
+		   *max_activities >= DEFAULT_ACTIVITY_COUNT;
+}
+
+/* Reads commands from stdin line by line and executes them. */
+int main(int argc, char* argv[]) {
+	struct kanban board;
+	struct input in;
+	int c, max_tasks, max_users, max_activities;
+
+	if (!parse_options(argc, argv, &max_tasks, &max_users, &max_activities)) {
+		fputs(USAGE_STR "\n", stderr);
+		return 1;
+	}
+
+	if (!init_kanban(&board, max_tasks, max_users, max_activities))
+		put_line(NO_MEMORY_STR);
+	else {
+		init_input(&in);
+		/* While q isn't entered. */
+		while ((c = INPUT_GET(&in)) != 'q' && c != EOF)
+			read_command(&board, &in, c);
+	}
 
+	free_kanban(&board);
+	flush_output();
 	return 0;
 }
\ No newline at end of file
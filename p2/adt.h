@@ -8,45 +8,229 @@
 #define ADT_H
 
 struct fs;
+struct shards;
+struct writers;
+struct image;
 struct file;
 struct avl;
 struct table;
+struct index;
 struct list;
 struct link;
 
+/*
+ * A path component, pointing into the line it was found in, which isn't
+ * changed. Its hash is the one used to pick the shard which owns a path.
+ */
+struct component {
+	const char* start;		/* First character, not null terminated */
+	int length;				/* Number of characters */
+	unsigned int hash;		/* Hash of the characters */
+};
+
+/* A path split in components, where the root has no components. */
+struct path {
+	struct component* components;	/* Components, grown as needed */
+	int count;						/* Number of components */
+	int capacity;					/* Number of components allocated */
+};
+
+/* Sizes of a sub-tree, as printed by DU_COMMAND. */
+struct usage {
+	int files;				/* Number of files */
+	int values;				/* Number of files with a value */
+	int bytes;				/* Characters in the values */
+};
+
+/* An instruction line split by scan_instruction. */
+struct instruction {
+	int command_id;			/* Command identifier, UNKNOWN_ID if invalid */
+	const char* command;	/* Command name, not null terminated */
+	int command_length;		/* Number of characters in the command name */
+	char* args;				/* Everything after the command, trimmed */
+	int args_length;		/* Number of characters in args */
+	struct path path;		/* Components of the first argument */
+	char* value;			/* Everything after the first argument, trimmed */
+	int value_length;		/* Number of characters in value */
+};
+
 /*
  * Function pointer type passed to traversal functions. If the function returns
  * a non NULL value, the traversal is ended early.
  */
 typedef void*(*traverse_fn)(void*, struct file*);
 
+/* Output function prototypes. */
+
+int output_create(int size);
+void output_destroy(void);
+void output_flush(void);
+void output_commit(void);
+void output_write(const char* str, int length);
+void output_str(const char* str);
+void output_puts(const char* str);
+void output_char(char c);
+void output_int(int value);
+
+/* Scanner function prototypes. */
+
+int scan_init(void);
+const char* scan_command_name(int id);
+int scan_path(struct path* path, const char* str, int length);
+int scan_instruction(struct instruction* instruction, char* line);
+void scan_release(struct path* path);
+
+/* Trace function prototypes. */
+
+int trace_create(const char* filename);
+void trace_destroy(void);
+void trace_begin(const struct instruction* instruction);
+void trace_end(int nodes);
+int trace_dump(void);
+void trace_poll(void);
+int trace_decode(const char* filename);
+
+/* Spinlock function prototypes. */
+
+void lock_acquire(int* lock);
+void lock_release(int* lock);
+
+/* Packed value function prototypes. */
+
+char* value_pack(const char* value, int length, int* size);
+const char* value_unpack(const char* packed);
+int value_saved(const char* packed);
+int value_size(const char* packed);
+unsigned int value_hash(const char* value);
+
+/* Replication function prototypes. */
+
+int repl_lead(struct fs* fs, const char* path);
+int repl_follow(struct fs* fs, const char* path);
+void repl_stop(void);
+int repl_leading(void);
+int repl_following(void);
+int repl_read_only(void);
+void repl_lock(void);
+void repl_unlock(void);
+int repl_set(const struct path* path, const char* value, int length,
+			 int time);
+int repl_delete(const struct path* path, int time);
+int repl_delete_value(const char* value, int time);
+void repl_commit(void);
+int repl_count(void);
+int repl_lag(void);
+
 /* Filesystem and file ADT function prototypes. */
 
 struct fs* filesystem_create(void);
 void filesystem_destroy(struct fs* fs);
+struct file* filesystem_root(struct fs* fs);
+int filesystem_time(struct fs* fs);
+void filesystem_set_time(struct fs* fs, int time);
+void filesystem_set_packing(struct fs* fs, int length);
+void filesystem_set_shared(struct fs* fs, int shared);
+void filesystem_settle(struct fs* fs);
+int filesystem_packing(struct fs* fs);
+int filesystem_packed(struct fs* fs);
+int filesystem_saved(struct fs* fs);
+int filesystem_reclaim(struct fs* fs, int count);
+int filesystem_compact(struct fs* fs);
+int filesystem_pending(struct fs* fs);
+int filesystem_files(struct fs* fs);
+int filesystem_reclaimed(struct fs* fs);
+int filesystem_touched(struct fs* fs);
 
-struct file* file_create(struct fs* fs, char* path);
+struct file* file_create(struct fs* fs, const struct path* path);
 void file_delete(struct fs* fs, struct file* file);
-struct file* file_set(struct fs* fs, char* path, char* value);
+int file_delete_value(struct fs* fs, const char* value);
+struct file* file_set(struct fs* fs, const struct path* path, const char* value,
+					  int length);
 
-struct file* file_find(struct fs* fs, char* path);
+struct file* file_find(struct fs* fs, const struct path* path);
 struct file* file_search(struct fs* fs, char* value);
+struct file* file_search_within(struct fs* fs, const char* value,
+								struct file* scope);
+int file_search_prefix(struct fs* fs, const char* prefix, struct file*** files,
+					   int* count);
+int file_sort(struct file** files, int count);
 void file_print_path(struct file* file);
 void file_print(struct fs* fs);
+void file_print_tree(struct fs* fs, struct file* file);
+void* file_traverse(struct file* file, void* ptr, traverse_fn fn);
 void file_list(struct file* file);
 
 const char* file_value(struct file* file);
+int file_has_value(struct file* file);
+unsigned int file_value_hash(struct file* file);
 const char* file_component(struct file* file);
 struct file* file_parent(struct file* file);
 int file_time(struct file* file);
 int file_height(struct file* file);
+int file_compare(struct file* lhs, struct file* rhs);
+int file_alive(struct file* file);
+void file_usage(struct file* file, struct usage* usage);
+unsigned long file_digest(struct file* file);
+unsigned long file_digest_files(struct file** top, int count);
+struct file** file_children(struct file* file, int* count);
+
+/* Sharded filesystem function prototypes. */
+
+struct shards* shards_create(int count);
+void shards_destroy(struct shards* shards);
+int shards_set(struct shards* shards, const struct path* path,
+			   const char* value, int length);
+struct fs* shards_route(struct shards* shards, const struct path* path);
+int shards_print(struct shards* shards);
+int shards_list(struct shards* shards);
+struct file** shards_files(struct shards* shards, int* count);
+struct file* shards_search(struct shards* shards, char* value);
+int shards_search_prefix(struct shards* shards, const char* prefix,
+						 struct file*** files, int* count);
+int shards_delete(struct shards* shards, const struct path* path);
+int shards_delete_value(struct shards* shards, const char* value);
+void shards_reclaim(struct shards* shards);
+struct fs* shards_fs(struct shards* shards, int i);
+int shards_export(struct shards* shards, const char* filename);
+
+/* Concurrent writer function prototypes. */
+
+struct writers* writers_create(struct fs* fs, int count);
+void writers_destroy(struct writers* writers);
+int writers_set(struct writers* writers, const struct path* path,
+				const char* value, int length);
+void writers_wait(struct writers* writers);
+
+/* Read-only image function prototypes. */
+
+int image_export(struct fs* fs, const char* filename);
+int image_export_files(const char* filename, struct file** top, int count);
+struct image* image_open(const char* filename);
+void image_close(struct image* image);
+int image_count(struct image* image);
+int image_find(struct image* image, const struct path* path);
+const char* image_value(struct image* image, int node);
+const char* image_component(struct image* image, int node);
+void image_usage(struct image* image, int node, struct usage* usage);
+unsigned long image_digest(struct image* image, int node);
+const unsigned int* image_children(struct image* image, int node, int* count);
+void image_print_path(struct image* image, int node);
+void image_print(struct image* image, int node);
+void image_list(struct image* image, int node);
+int image_search(struct image* image, const char* value, int node);
+int image_search_prefix(struct image* image, const char* prefix);
+
+/* Digest comparison function prototypes. */
+
+int diff_files(struct file** top, int count, struct image* image);
+int diff_images(struct image* lhs_image, struct image* rhs_image);
 
 /* AVL tree ADT function prototypes. */
 
 struct avl* avl_insert(struct avl* avl, struct file* file);
 struct avl* avl_remove(struct avl* avl, struct file* file);
 void avl_destroy(struct avl* avl);
-struct file* avl_find(struct avl* avl, const char* key);
+struct file* avl_find(struct avl* avl, const char* key, int length);
 void* avl_traverse(struct avl* avl, void* ptr, traverse_fn fn);
 
 /* Hash table function prototypes. */
@@ -55,7 +239,24 @@ struct table* table_create(void);
 void table_destroy(struct table* table);
 int table_insert(struct table* table, struct file* file);
 void table_remove(struct table* table, struct file* file);
+void table_remove_value(struct table* table, const char* value);
+void table_remove_deleted(struct table* table, struct file** files,
+						  int count);
 struct file* table_search(struct table* table, const char* value);
+void* table_traverse(struct table* table, const char* value, void* ptr,
+					 traverse_fn fn);
+
+/* Ordered value index function prototypes. */
+
+struct index* index_create(void);
+void index_destroy(struct index* index);
+int index_insert(struct index* index, struct file* file);
+void index_remove(struct index* index, struct file* file);
+void index_remove_value(struct index* index, const char* value);
+void index_remove_deleted(struct index* index, struct file** files,
+						  int count);
+void* index_traverse_prefix(struct index* index, const char* prefix, void* ptr,
+							traverse_fn fn);
 
 /* Doubly linked list ADT function prototypes. */
 
@@ -63,6 +264,7 @@ struct list* list_create(void);
 void list_destroy(struct list* list);
 struct link* list_insert(struct list* list, struct file* file);
 void list_remove(struct list* list, struct link* link);
+void list_remove_if(struct list* list, void* ptr, traverse_fn fn);
 void* list_traverse(struct list* list, void* ptr, traverse_fn fn);
 struct link* list_find(struct list* list, struct file* file);
 struct file* list_first(struct list* list);
@@ -9,14 +9,57 @@
 #include <string.h>
 #include <stdlib.h>
 
-/* An AVL tree node. */
+/*
+ * An AVL tree node. The first characters of the file's component are kept in
+ * the node, packed into prefix, so that most comparisons are decided without
+ * reading the file or its component.
+ */
 struct avl {
-	struct file* file;	/* File this node points to */
-	struct avl* left;	/* Left (smaller) node, may be NULL */
-	struct avl* right;	/* Right (bigger) node, may be NULL */
-	int height;			/* Height of the sub-tree rooted on this node */
+	struct file* file;		/* File this node points to */
+	struct avl* left;		/* Left (smaller) node, may be NULL */
+	struct avl* right;		/* Right (bigger) node, may be NULL */
+	unsigned long prefix;	/* First characters of the key, see avl_prefix */
+	int length;				/* Number of characters in the key */
+	int height;				/* Height of the sub-tree rooted on this node */
 };
 
+/* Number of characters packed into a prefix. */
+#define AVL_PREFIX_SIZE ((int)sizeof(unsigned long))
+
+/*
+ * Packs the first characters of a key with length characters into a number,
+ * the first character in the most significant byte and padded with zeros.
+ * Prefixes compare as numbers like their keys do with strcmp.
+ */
+static unsigned long avl_prefix(const char* key, int length) {
+	unsigned long prefix = 0;
+	int i;
+
+	for (i = 0; i < AVL_PREFIX_SIZE; ++i)
+		prefix = prefix << 8 | (i < length ? (unsigned char)key[i] : 0);
+	return prefix;
+}
+
+/*
+ * Compares a key, with length characters and packed into prefix, to a node's
+ * key, like strcmp does. The node's component is only read if both keys are
+ * longer than a prefix and their prefixes are the same.
+ */
+static int avl_compare(const struct avl* avl, unsigned long prefix,
+					   const char* key, int length) {
+	int n = length < avl->length ? length : avl->length, cmp = 0;
+
+	if (prefix != avl->prefix)
+		return prefix < avl->prefix ? -1 : 1;
+
+	/* Keys have no null characters, so equal prefixes mean equal padding */
+	if (n > AVL_PREFIX_SIZE)
+		cmp = memcmp(key + AVL_PREFIX_SIZE,
+					 file_component(avl->file) + AVL_PREFIX_SIZE,
+					 n - AVL_PREFIX_SIZE);
+	return cmp != 0 ? cmp : length - avl->length;
+}
+
 /* Returns the height of a sub-tree of an AVL. */
 static int avl_height(struct avl* avl) {
 	return avl == NULL ? 0 : avl->height;	
@@ -103,11 +146,11 @@ static struct avl* avl_max(struct avl* avl) {
 }
 
 /*
- * Inserts a file into an AVL. If the memory allocation fails, the tree is left
- * unchanged and NULL is returned. Otherwise a pointer to the new AVL root is
- * returned.
+ * Auxiliar function to avl_insert, inserts a file whose key has length
+ * characters and is packed into prefix.
  */
-struct avl* avl_insert(struct avl* avl, struct file* file) {
+static struct avl* avl_insert_key(struct avl* avl, struct file* file,
+								  unsigned long prefix, int length) {
 	struct avl* new;
 	int cmp;
 
@@ -116,13 +159,16 @@ struct avl* avl_insert(struct avl* avl, struct file* file) {
 		if (avl == NULL) /* Allocation failed */
 			return NULL;
 		avl->file = file;
+		avl->prefix = prefix;
+		avl->length = length;
 		avl->height = 1;
 	}
 	else {
-		if (!(cmp = strcmp(file_component(file), file_component(avl->file))))
+		if (!(cmp = avl_compare(avl, prefix, file_component(file), length)))
 			return avl; /* File already in the AVL, don't change anything */
-	
-		if ((new = avl_insert(cmp > 0 ? avl->right : avl->left, file)) == NULL)
+
+		if ((new = avl_insert_key(cmp > 0 ? avl->right : avl->left, file,
+								  prefix, length)) == NULL)
 			return NULL; /* Allocation failed */
 
 		cmp > 0 ? (avl->right = new) : (avl->left = new); /* Update sub-tree */
@@ -131,22 +177,40 @@ struct avl* avl_insert(struct avl* avl, struct file* file) {
 	return avl_balance(avl); /* Balance tree */
 }
 
-/* Removes a file from an AVL. A pointer to the new AVL root is returned. */
-struct avl* avl_remove(struct avl* avl, struct file* file) {
+/*
+ * Inserts a file into an AVL. If the memory allocation fails, the tree is left
+ * unchanged and NULL is returned. Otherwise a pointer to the new AVL root is
+ * returned.
+ */
+struct avl* avl_insert(struct avl* avl, struct file* file) {
+	const char* key = file_component(file);
+	int length = strlen(key);
+
+	return avl_insert_key(avl, file, avl_prefix(key, length), length);
+}
+
+/*
+ * Auxiliar function to avl_remove, removes a file whose key has length
+ * characters and is packed into prefix.
+ */
+static struct avl* avl_remove_key(struct avl* avl, struct file* file,
+								  unsigned long prefix, int length) {
 	struct avl* aux = avl;
 	int cmp;
 
 	if (avl == NULL)
 		return NULL;
-	cmp = strcmp(file_component(file), file_component(avl->file)); /* BSearch */
+	cmp = avl_compare(avl, prefix, file_component(file), length); /* BSearch */
 	if (cmp < 0)
-		avl->left = avl_remove(avl->left, file);
+		avl->left = avl_remove_key(avl->left, file, prefix, length);
 	else if (cmp > 0)
-		avl->right = avl_remove(avl->right, file);
+		avl->right = avl_remove_key(avl->right, file, prefix, length);
 	else if (avl->left != NULL && avl->right != NULL) {
 		aux = avl_max(avl->left); /* Found a internal node */
 		avl->file = aux->file, aux->file = file;
-		avl->left = avl_remove(avl->left, file);
+		avl->prefix = aux->prefix, aux->prefix = prefix;
+		avl->length = aux->length, aux->length = length;
+		avl->left = avl_remove_key(avl->left, file, prefix, length);
 	}
 	else {
 		if (avl->left == NULL && avl->right == NULL) /* Leaf node */
@@ -158,22 +222,27 @@ struct avl* avl_remove(struct avl* avl, struct file* file) {
 	return avl_balance(avl); /* Balance tree */
 }
 
+/* Removes a file from an AVL. A pointer to the new AVL root is returned. */
+struct avl* avl_remove(struct avl* avl, struct file* file) {
+	const char* key = file_component(file);
+	int length = strlen(key);
+
+	return avl_remove_key(avl, file, avl_prefix(key, length), length);
+}
+
 /*
- * Finds a file in the AVL tree with a certain key (file->component) and returns
- * a pointer to it. If no file is found, NULL is returned.
+ * Finds a file in the AVL tree with a certain key (file->component), given by
+ * its first length characters, and returns a pointer to it. If no file is
+ * found, NULL is returned.
  */
-struct file* avl_find(struct avl* avl, const char* key) {
+struct file* avl_find(struct avl* avl, const char* key, int length) {
+	unsigned long prefix = avl_prefix(key, length);
 	int cmp;
-		
-	if (avl == NULL)
-		return NULL;
 
-	cmp = strcmp(key, file_component(avl->file)); /* Binary search */
-	if (cmp < 0)
-		return avl_find(avl->left, key);
-	else if (cmp > 0)
-		return avl_find(avl->right, key);
-	return avl->file;
+	/* Binary search, the key is packed once for every node compared */
+	while (avl != NULL && (cmp = avl_compare(avl, prefix, key, length)) != 0)
+		avl = cmp < 0 ? avl->left : avl->right;
+	return avl == NULL ? NULL : avl->file;
 }
 
 /* Frees all memory associated with an AVL tree. */
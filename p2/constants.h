@@ -10,9 +10,85 @@
 /* The maximum number of characters in a instruction. */
 #define MAX_INSTRUCTION_SIZE 65536
 
+/* Number of characters read from stdin at once. */
+#define INPUT_BUFFER_SIZE 65536
+
 /* Number of cells in the value to file hash table, must be a prime. */
 #define HASH_TABLE_SIZE 65537
 
+/*
+ * Number of links in the first and largest chunks of an unrolled list. Each
+ * chunk appended to a list doubles in size until the maximum is reached.
+ */
+#define LIST_CHUNK_MIN_SIZE 2
+#define LIST_CHUNK_MAX_SIZE 64
+
+/* Number of commands which can be queued on a shard, must be a power of 2. */
+#define SHARD_QUEUE_SIZE 1024
+
+/* Number of times a shard polls its queue before going to sleep. */
+#define SHARD_SPIN_COUNT 1000
+
+/* The maximum number of shards which can be requested. */
+#define MAX_SHARD_COUNT 64
+
+/*
+ * The maximum number of concurrent writers which can be requested. Each one
+ * has a queue like a shard's.
+ */
+#define MAX_WRITER_COUNT 64
+
+/* Number of times a spinlock is polled before yielding the processor. */
+#define LOCK_SPIN_COUNT 128
+
+/* Number of locks shared by the buckets of a value table, a power of 2. */
+#define TABLE_LOCK_COUNT 256
+
+/*
+ * Number of deleted files freed between commands. Deleting a large sub-tree
+ * only unlinks it and its values, and its files are freed in increments of
+ * this size.
+ */
+#define RECLAIM_BATCH_SIZE 256
+
+/*
+ * Default size in bytes of each of the two output buffers. Commands stall once
+ * both are full, waiting for stdout to be written.
+ */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * Size in bytes from which a batch of replicated changes is shipped without
+ * waiting for the previous one, and of each snapshot batch.
+ */
+#define REPL_BUFFER_SIZE 65536
+
+/* Number of commands kept by the trace, must be a power of 2. */
+#define TRACE_RING_SIZE 65536
+
+/* Signal which makes the trace be dumped after the current command. */
+#define TRACE_SIGNAL SIGUSR1
+
+/* Identifies trace files and their layout version. */
+#define TRACE_MAGIC "P2TR"
+#define TRACE_VERSION 6
+
+/* Column names printed when decoding a trace. */
+#define TRACE_COLUMNS "command count mean p50 p99 max nodes"
+
+/* Identifies read-only image files and their layout version. */
+#define IMAGE_MAGIC "P2IX"
+#define IMAGE_VERSION 2
+
+/* Marks a missing value or parent in an image file. */
+#define IMAGE_NONE 0xFFFFFFFFu
+
+/*
+ * Characters added to an image's file name for the temporary file it is
+ * written to, enough for ".<process ID>.tmp" and the terminator.
+ */
+#define IMAGE_TEMP_SUFFIX_SIZE 32
+
 /* Whitespace characters */
 #define WHITESPACE_CHARS " \t\n"
 
@@ -21,6 +97,17 @@
 #define QUIT_CODE 1
 #define NO_MEMORY_CODE 2
 
+/* Command line options */
+#define SHARDS_OPTION "-s"
+#define OUTPUT_OPTION "-o"
+#define QUERY_OPTION "-q"
+#define TRACE_OPTION "-t"
+#define DECODE_OPTION "-d"
+#define LEADER_OPTION "-l"
+#define FOLLOWER_OPTION "-f"
+#define PACK_OPTION "-z"
+#define WRITERS_OPTION "-w"
+
 /* Command names */
 #define QUIT_COMMAND "quit"
 #define HELP_COMMAND "help"
@@ -29,23 +116,105 @@
 #define FIND_COMMAND "find"
 #define LIST_COMMAND "list"
 #define SEARCH_COMMAND "search"
+#define SEARCHPREFIX_COMMAND "searchprefix"
 #define DELETE_COMMAND "delete"
+#define STATS_COMMAND "stats"
+#define EXPORT_COMMAND "export"
+#define HASH_COMMAND "hash"
+#define DIFF_COMMAND "diff"
+#define DU_COMMAND "du"
+#define COMPACT_COMMAND "compact"
+#define DELETEVALUE_COMMAND "deletevalue"
+#define SEARCHIN_COMMAND "searchin"
+
+/*
+ * Command identifiers, found by scan_instruction. UNKNOWN_ID is also the number
+ * of known commands. Trace files store them, so TRACE_VERSION must change
+ * whenever they do.
+ */
+#define QUIT_ID 0
+#define HELP_ID 1
+#define SET_ID 2
+#define PRINT_ID 3
+#define FIND_ID 4
+#define LIST_ID 5
+#define SEARCH_ID 6
+#define SEARCHPREFIX_ID 7
+#define DELETE_ID 8
+#define STATS_ID 9
+#define EXPORT_ID 10
+#define HASH_ID 11
+#define DIFF_ID 12
+#define DU_ID 13
+#define COMPACT_ID 14
+#define DELETEVALUE_ID 15
+#define SEARCHIN_ID 16
+#define UNKNOWN_ID 17
+
+/*
+ * Number of slots in the command dispatch table, must be a power of 2. Every
+ * command must have a slot of its own (see scan_init).
+ */
+#define DISPATCH_TABLE_SIZE 32
 
 /* Error strings */
 #define NO_MEMORY_ERROR "No memory."
 #define NOT_FOUND_ERROR "not found"
 #define NO_DATA_ERROR "no data"
+#define EXPORT_ERROR "could not export"
+#define READ_ONLY_ERROR "read only"
+#define IMAGE_ERROR "invalid image"
+#define TRACE_ERROR "invalid trace"
+#define REPL_ERROR "could not replicate"
+#define REPL_APPLY_ERROR "could not apply the replication log, read only"
+#define REPL_LEADER_ERROR "leader disconnected, taking writes"
+#define USAGE_ERROR \
+	"usage: proj2 [-s shards] [-o output buffer size] [-q image file] "\
+	"[-t trace file] [-d trace file] [-l socket | -f socket] "\
+	"[-z shortest packed value] [-w writers]"
+
+/* Markers printed by DIFF_COMMAND before each path which differs */
+#define DIFF_ADDED '+'		/* Only on this side, with every path beneath it */
+#define DIFF_REMOVED '-'	/* Only on the image, with every path beneath it */
+#define DIFF_CHANGED '*'	/* On both sides, with different values */
+
+/* Counter names printed by STATS_COMMAND */
+#define STATS_FILES "files"
+#define STATS_PENDING "pending"
+#define STATS_RECLAIMED "reclaimed"
+#define STATS_LOGGED "logged"
+#define STATS_APPLIED "applied"
+#define STATS_LAG "lag"
+#define STATS_DISCONNECTED "disconnected"
+#define STATS_PACKED "packed"
+#define STATS_SAVED "saved"
 
-/* Message written to stdin when HELP_COMMAND is executed */
+/*
+ * Message written to stdin when HELP_COMMAND is executed. It is split in two
+ * strings, since C89 compilers only need to support strings of 509 characters.
+ */
 #define HELP_MESSAGE \
 	HELP_COMMAND	": Imprime os comandos disponíveis.\n"\
 	QUIT_COMMAND	": Termina o programa.\n"\
 	SET_COMMAND 	": Adiciona ou modifica o valor a armazenar.\n"\
-	PRINT_COMMAND	": Imprime todos os caminhos e valores.\n"\
+	PRINT_COMMAND	": Imprime os caminhos e valores (sob um caminho).\n"\
 	FIND_COMMAND	": Imprime o valor armazenado.\n"\
 	LIST_COMMAND 	": Lista todos os componentes imediatos de um sub-caminho."\
 					"\n"\
 	SEARCH_COMMAND	": Procura o caminho dado um valor.\n"\
-	DELETE_COMMAND	": Apaga um caminho e todos os subcaminhos."
+	SEARCHPREFIX_COMMAND ": Procura os caminhos cujo valor começa por um "\
+					"prefixo.\n"\
+	SEARCHIN_COMMAND ": Procura o caminho dado um valor sob um caminho."
+#define HELP_MESSAGE_EXTRA \
+	DELETE_COMMAND	": Apaga um caminho e todos os subcaminhos.\n"\
+	DELETEVALUE_COMMAND ": Apaga os caminhos com um valor e os subcaminhos.\n"\
+	STATS_COMMAND	": Imprime o número de ficheiros alocados e por "\
+					"libertar.\n"\
+	EXPORT_COMMAND	": Exporta uma imagem só de leitura para um ficheiro.\n"\
+	HASH_COMMAND	": Imprime o resumo de um caminho e dos subcaminhos.\n"\
+	DIFF_COMMAND	": Imprime os caminhos diferentes numa imagem.\n"\
+	DU_COMMAND		": Imprime o número de caminhos, valores e bytes num "\
+					"caminho.\n"\
+	COMPACT_COMMAND	": Arruma os ficheiros em memória contígua."
 
 #endif
\ No newline at end of file
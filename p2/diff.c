@@ -0,0 +1,223 @@
+/*
+ * File: 		diff.c
+ * Author: 		Ricardo Antunes
+ * Description: Compares a filesystem, or an image, with an image by their
+ * 				digests, descending only into sub-trees which differ.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/*
+ * One of the two sides being compared. A filesystem is given by its top-level
+ * files, so that the shards of a sharded filesystem are compared as one.
+ */
+struct diff_side {
+	struct image* image;	/* Image, or NULL if the side is a filesystem */
+	struct file** top;		/* Top-level files, sorted lexicographically */
+	int count;				/* Number of top-level files */
+};
+
+/* A file or an image node on one of the sides. */
+struct diff_node {
+	const struct diff_side* side;	/* Side the node belongs to */
+	struct file* file;				/* File, NULL for images and the root */
+	int node;						/* Node, if the side is an image */
+};
+
+/* The children of a node, sorted lexicographically by component. */
+struct diff_children {
+	struct file** files;		/* Children of a file, NULL for images */
+	const unsigned int* nodes;	/* Children of an image node */
+	int count;					/* Number of children */
+	int owned;					/* Set if files must be freed */
+};
+
+/* Returns the digest of a node's sub-tree. */
+static unsigned long diff_digest(const struct diff_node* node) {
+	const struct diff_side* side = node->side;
+
+	if (side->image != NULL)
+		return image_digest(side->image, node->node);
+	if (node->file != NULL)
+		return file_digest(node->file);
+	return file_digest_files(side->top, side->count);
+}
+
+/* Returns a node's value, which may be NULL. */
+static const char* diff_value(const struct diff_node* node) {
+	if (node->side->image != NULL)
+		return image_value(node->side->image, node->node);
+	return node->file == NULL ? NULL : file_value(node->file);
+}
+
+/* Returns a node's path component. Never called for the root. */
+static const char* diff_component(const struct diff_node* node) {
+	if (node->side->image != NULL)
+		return image_component(node->side->image, node->node);
+	return file_component(node->file);
+}
+
+/* Prints a node's path preceded by a marker (see DIFF_CHANGED). */
+static void diff_print(const struct diff_node* node, char marker) {
+	output_char(marker);
+	output_char(' ');
+	if (node->side->image != NULL)
+		image_print_path(node->side->image, node->node);
+	else
+		file_print_path(node->file);
+	output_char('\n');
+}
+
+/*
+ * Gets the children of a node. Returns 0 if a memory allocation failed,
+ * otherwise returns 1, and the children must be released with diff_release.
+ */
+static int diff_children(const struct diff_node* node,
+						 struct diff_children* children) {
+	const struct diff_side* side = node->side;
+
+	children->files = NULL;
+	children->nodes = NULL;
+	children->owned = 0;
+
+	if (side->image != NULL)
+		children->nodes = image_children(side->image, node->node,
+										 &children->count);
+	else if (node->file == NULL) {
+		children->files = side->top;
+		children->count = side->count;
+	}
+	else {
+		children->files = file_children(node->file, &children->count);
+		children->owned = 1;
+	}
+
+	return side->image != NULL || children->files != NULL;
+}
+
+/* Gets the i-th child of a node, found by diff_children. */
+static void diff_child(const struct diff_node* node,
+					   const struct diff_children* children, int i,
+					   struct diff_node* child) {
+	child->side = node->side;
+	if (children->files != NULL) {
+		child->file = children->files[i];
+		child->node = 0;
+	}
+	else {
+		child->file = NULL;
+		child->node = children->nodes[i];
+	}
+}
+
+/* Frees the memory used by the children of a node. */
+static void diff_release(struct diff_children* children) {
+	if (children->owned)
+		free(children->files);
+}
+
+/*
+ * Compares two nodes with the same path. Sub-trees with the same digest are
+ * skipped, otherwise their values are compared and their children are merged
+ * by component: children on a single side are printed, and those on both
+ * sides are compared in turn. Returns 0 if a memory allocation failed,
+ * otherwise returns 1.
+ */
+static int diff_compare(const struct diff_node* lhs,
+						const struct diff_node* rhs) {
+	struct diff_children lhs_children, rhs_children;
+	struct diff_node lhs_child, rhs_child;
+	const char* lhs_value, * rhs_value;
+	int i = 0, j = 0, cmp, ok = 1;
+
+	if (diff_digest(lhs) == diff_digest(rhs))
+		return 1; /* Same paths and values beneath both */
+
+	lhs_value = diff_value(lhs);
+	rhs_value = diff_value(rhs);
+	if (lhs_value == NULL ? rhs_value != NULL :
+		rhs_value == NULL || strcmp(lhs_value, rhs_value) != 0)
+		diff_print(lhs, DIFF_CHANGED);
+
+	if (!diff_children(lhs, &lhs_children))
+		return 0; /* Allocation failed */
+	if (!diff_children(rhs, &rhs_children)) {
+		diff_release(&lhs_children);
+		return 0; /* Allocation failed */
+	}
+
+	while (ok && (i < lhs_children.count || j < rhs_children.count)) {
+		if (i < lhs_children.count)
+			diff_child(lhs, &lhs_children, i, &lhs_child);
+		if (j < rhs_children.count)
+			diff_child(rhs, &rhs_children, j, &rhs_child);
+
+		if (i == lhs_children.count)
+			cmp = 1;
+		else if (j == rhs_children.count)
+			cmp = -1;
+		else
+			cmp = strcmp(diff_component(&lhs_child),
+						 diff_component(&rhs_child));
+
+		if (cmp < 0) {
+			diff_print(&lhs_child, DIFF_ADDED);
+			++i;
+		}
+		else if (cmp > 0) {
+			diff_print(&rhs_child, DIFF_REMOVED);
+			++j;
+		}
+		else {
+			ok = diff_compare(&lhs_child, &rhs_child);
+			++i;
+			++j;
+		}
+	}
+
+	diff_release(&lhs_children);
+	diff_release(&rhs_children);
+	return ok;
+}
+
+/* Compares the roots of two sides, see diff_compare. */
+static int diff_roots(const struct diff_side* lhs_side,
+					  const struct diff_side* rhs_side) {
+	struct diff_node lhs, rhs;
+
+	lhs.side = lhs_side;
+	rhs.side = rhs_side;
+	lhs.file = rhs.file = NULL;
+	lhs.node = rhs.node = 0;
+	return diff_compare(&lhs, &rhs);
+}
+
+/*
+ * Prints the paths which differ between a filesystem, given by its top-level
+ * files sorted lexicographically, and an image. Returns 0 if a memory
+ * allocation failed, otherwise returns 1.
+ */
+int diff_files(struct file** top, int count, struct image* image) {
+	struct diff_side lhs = { NULL, NULL, 0 }, rhs = { NULL, NULL, 0 };
+
+	lhs.top = top;
+	lhs.count = count;
+	rhs.image = image;
+	return diff_roots(&lhs, &rhs);
+}
+
+/*
+ * Prints the paths which differ between two images. Returns 0 if a memory
+ * allocation failed, otherwise returns 1.
+ */
+int diff_images(struct image* lhs_image, struct image* rhs_image) {
+	struct diff_side lhs = { NULL, NULL, 0 }, rhs = { NULL, NULL, 0 };
+
+	lhs.image = lhs_image;
+	rhs.image = rhs_image;
+	return diff_roots(&lhs, &rhs);
+}
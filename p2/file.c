@@ -5,8 +5,10 @@
  */
 
 #include <string.h>
-#include <stdio.h>
 #include <stdlib.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "adt.h"
 
@@ -14,52 +16,277 @@
 struct fs {
 	struct file* root;			/* Root file ('/') */
 	struct table* value_table;	/* Hash table used to search by value */
+	struct index* value_index;	/* Ordered index used to search by prefix */
 	int time;					/* Current time (number of files inserted) */
+
+	struct list* pending;		/* Deleted sub-trees waiting to be freed */
+	int pending_count;			/* Number of sub-trees in pending */
+	int files;					/* Number of files allocated, except root */
+	int reclaimed;				/* Number of files freed after a delete */
+	int touched;				/* Files visited by lookups, prints and frees */
+
+	int pack_length;			/* Shortest value packed, 0 if not packing */
+	int packed;					/* Number of values packed */
+	int saved;					/* Bytes saved by packing values */
+	int shared;					/* Set if written by concurrent writers */
+	int labeled;				/* Cleared if writers ran out of labels */
 };
 
 /* Describes a file. */
 struct file {
-	char* value;				/* File value, may be NULL */
+	char* value;				/* File value, may be NULL or packed */
+	unsigned int value_hash;	/* Hash of the value, see value_hash */
+	int packed;					/* Set if the value is packed */
 	char* component;			/* File path component */
 	int time;					/* File creation time */
 	int height;					/* File height in the tree */
+	unsigned long digest;		/* Digest of the sub-tree, see file_digest */
+	struct usage usage;			/* Sizes of the sub-tree, see file_usage */
+	int lock;					/* Held while changing the children */
+	int dirty;					/* Set if digest is out of date */
+	struct block* block;		/* Block holding the file, or NULL */
+	int block_value;			/* Set if the value is kept in the block */
+	unsigned long enter;		/* First label of the sub-tree */
+	unsigned long leave;		/* Label after the last one of the sub-tree */
+	unsigned long next;			/* First label left for new children */
 
 	struct file* parent;		/* Parent file */
 	struct avl* avl_children;	/* Children sorted lexicographically */
 	struct list* l_children; 	/* Children sorted by creation time */
 	struct link* l_self;		/* The link where this file is (may be NULL) */
+	int deleted;				/* Set once the file's sub-tree was deleted */
+};
+
+/*
+ * Memory where filesystem_compact moves every file, in DFS order, followed by
+ * their components and values. A moved file's component stays in the block,
+ * and so does its value until it is changed. The block is freed once every
+ * file in it has been freed.
+ */
+struct block {
+	int live;				/* Files in the block not yet freed */
+	struct file files[1];	/* Files, allocated with the block */
 };
 
-/* Allocates a new file and fills it with default data. */
-static struct file* file_alloc(const char* comp, int time) {
+/*
+ * Concurrent writers (see writer.c) change counters and sizes with atomic
+ * additions, and mark digests out of date with atomic loads and stores. They
+ * never change the same file's value, and they change its children with its
+ * lock held.
+ */
+#define ADD(x, n) ((void)__atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED))
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/*
+ * Each file created takes one in 2^FILE_LABEL_SHIFT of the labels its parent
+ * has left, see file_label. A sub-tree is relabeled on its own once it has at
+ * least 2^FILE_ROOM_SHIFT labels for each file in it, see file_make_room.
+ */
+#define FILE_LABEL_SHIFT 4
+#define FILE_ROOM_SHIFT 8
+
+/* Digests are built from 64 bit hashes. */
+typedef char file_check_ulong_size[sizeof(unsigned long) >= 8 ? 1 : -1];
+
+/* Mixes the bits of a hash (the finalizer of MurmurHash3). */
+static unsigned long file_mix(unsigned long h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDul;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ul;
+	h ^= h >> 33;
+	return h;
+}
+
+/* Hashes a string, continuing from h (FNV-1a). */
+static unsigned long file_hash_str(unsigned long h, const char* str) {
+	for (; *str != '\0'; ++str)
+		h = (h ^ (unsigned char)*str) * 0x100000001B3ul;
+	return h;
+}
+
+/* Hashes a file's own component and value, which may be NULL. */
+static unsigned long file_hash_self(const char* component, const char* value) {
+	unsigned long h = file_mix(file_hash_str(0xCBF29CE484222325ul, component));
+
+	if (value != NULL)
+		h = file_mix(file_hash_str(h, value) + 1);
+	return h;
+}
+
+/*
+ * Sets the digest of a file and updates the digests of its ancestors. Each
+ * parent only needs the old and new digests of the child which changed, so
+ * this takes time proportional to the file's height.
+ */
+static void file_update_digest(struct file* file, unsigned long digest) {
+	unsigned long old;
+
+	for (;;) {
+		old = file->digest;
+		file->digest = digest;
+		if ((file = file->parent) == NULL)
+			return;
+		digest = file->digest - file_mix(old) + file_mix(digest);
+	}
+}
+
+/*
+ * Adds to the sizes of a file's sub-tree and of its ancestors' sub-trees. This
+ * takes time proportional to the file's height.
+ */
+static void file_update_usage(struct fs* fs, struct file* file, int files,
+							  int values, int bytes) {
+	for (; file != NULL; file = file->parent)
+		if (fs->shared) {
+			ADD(file->usage.files, files);
+			ADD(file->usage.values, values);
+			ADD(file->usage.bytes, bytes);
+		}
+		else {
+			file->usage.files += files;
+			file->usage.values += values;
+			file->usage.bytes += bytes;
+		}
+}
+
+/*
+ * Marks the digests of a file and of its ancestors as out of date, for
+ * concurrent writers, which can't update them in order. A marked file's
+ * ancestors are marked or about to be, so marking stops there.
+ */
+static void file_mark_digest(struct file* file) {
+	for (; file != NULL && !LOAD(file->dirty); file = file->parent)
+		STORE(file->dirty, 1);
+}
+
+static unsigned long file_settle(struct file* file);
+
+/* Auxiliar function to file_settle, adds the digest of a child. */
+static void* file_settle_aux(void* digest_v, struct file* file) {
+	*(unsigned long*)digest_v += file_mix(file_settle(file));
+	return NULL;
+}
+
+/*
+ * Recomputes the digests marked as out of date in a file's sub-tree, skipping
+ * sub-trees which weren't marked, and returns the file's digest.
+ */
+static unsigned long file_settle(struct file* file) {
+	unsigned long digest;
+
+	if (!file->dirty)
+		return file->digest;
+
+	digest = file_hash_self(file->component, file_value(file));
+	list_traverse(file->l_children, &digest, &file_settle_aux);
+	file->digest = digest;
+	file->dirty = 0;
+	return digest;
+}
+
+/*
+ * Allocates a new file and fills it with default data. Its component is the
+ * first length characters of comp.
+ */
+static struct file* file_alloc(const char* comp, int length, int time) {
 	struct file* file;
 	
 	if ((file = calloc(1, sizeof(struct file))) == NULL)
 		return NULL;
-	if ((file->component = malloc(strlen(comp) + 1)) == NULL) {
+	if ((file->component = malloc(length + 1)) == NULL) {
 		free(file); /* Allocation failed */
 		return NULL;
 	}
 	if ((file->l_children = list_create()) == NULL) { /* Create children list */
-		free(file); /* Allocation failed */
-		free(file->component);
+		free(file->component); /* Allocation failed */
+		free(file);
 		return NULL;
 	}
 
-	strcpy(file->component, comp);
+	memcpy(file->component, comp, length);
+	file->component[length] = '\0';
 	file->time = time;
+	file->digest = file_hash_self(file->component, NULL);
+	file->usage.files = 1;
 	
 	return file;
 }
 
+/* Frees a file's value, unless it is kept in the file's block. */
+static void file_free_value(struct file* file) {
+	if (!file->block_value)
+		free(file->value);
+	file->value = NULL;
+	file->block_value = 0;
+}
+
+/* Drops a file's value from the packing counters, if it is packed. */
+static void file_unpacked(struct fs* fs, struct file* file) {
+	if (file->packed) {
+		ADD(fs->packed, -1);
+		ADD(fs->saved, -value_saved(file->value));
+		file->packed = 0;
+	}
+}
+
+/*
+ * Packs a file's value, which has length characters, if it is long enough and
+ * packing saves memory. Otherwise the value is kept as it is.
+ */
+static void file_pack(struct fs* fs, struct file* file, int length) {
+	char* packed;
+	int size;
+
+	if (fs->pack_length == 0 || length < fs->pack_length ||
+		(packed = value_pack(file->value, length, &size)) == NULL)
+		return;
+
+	file_free_value(file);
+	file->value = packed;
+	file->packed = 1;
+	ADD(fs->packed, 1);
+	ADD(fs->saved, value_saved(packed));
+}
+
 /* Frees the memory associated with a file. */
 static void file_free(struct file* file) {
 	avl_destroy(file->avl_children);
 	list_destroy(file->l_children);
-	if (file->value != NULL)
-		free(file->value);
-	free(file->component);
-	free(file);
+	file_free_value(file);
+	if (file->block == NULL) {
+		free(file->component);
+		free(file);
+	}
+	else if (--file->block->live == 0)
+		free(file->block);
+}
+
+/*
+ * Frees a deleted file, already removed from the value table and index. Its
+ * children must have been freed already.
+ */
+static void file_reclaim(struct fs* fs, struct file* file) {
+	file_unpacked(fs, file);
+	file_free(file);
+	ADD(fs->files, -1);
+	++fs->reclaimed;
+	ADD(fs->touched, 1);
+}
+
+/*
+ * Frees a deleted sub-tree immediately. Used when it can't be queued to be
+ * freed later.
+ */
+static void file_reclaim_tree(struct fs* fs, struct file* file) {
+	struct file* child;
+
+	while ((child = list_first(file->l_children)) != NULL) {
+		list_remove(file->l_children, child->l_self);
+		file_reclaim_tree(fs, child);
+	}
+	file_reclaim(fs, file);
 }
 
 /*
@@ -85,16 +312,104 @@ static int file_add(struct file* parent, struct file* file) {
 	return 1;
 }
 
+/*
+ * Labels a new file, the last child of its parent. Every file's sub-tree gets
+ * an interval of labels, [enter, leave), nested in its parent's after the
+ * intervals of its older siblings, so a file is beneath another one if its
+ * enter label is in the other's interval, and files come in DFS order when
+ * sorted by their enter labels. The new file takes a share of the labels its
+ * parent has left, to make room for its own children. Returns 0 if there are
+ * none left, in which case the file is left unlabeled and a sub-tree holding
+ * it must be relabeled (see file_make_room), otherwise returns 1.
+ */
+static int file_label(struct file* parent, struct file* file) {
+	unsigned long left = parent->leave - parent->next;
+	unsigned long size = left >> FILE_LABEL_SHIFT;
+
+	if (left == 0)
+		return 0;
+
+	file->enter = parent->next;
+	file->leave = file->enter + (size != 0 ? size : 1);
+	file->next = file->enter + 1;
+	parent->next = file->leave;
+	return 1;
+}
+
+static void file_relabel(struct file* file, unsigned long enter,
+						 unsigned long leave, unsigned long unit);
+
+/*
+ * Auxiliar function to file_relabel, labels a child with unit labels for each
+ * file in its sub-tree.
+ */
+static void* file_relabel_aux(void* unit_v, struct file* file) {
+	struct file* parent = file->parent;
+	unsigned long unit = *(unsigned long*)unit_v;
+	unsigned long size = unit * file->usage.files;
+
+	file_relabel(file, parent->next, parent->next + size, unit);
+	parent->next += size;
+	return NULL;
+}
+
+/*
+ * Assigns the labels in [enter, leave) to a file's sub-tree, which must have
+ * at least unit labels for each file beneath the file. Each child's sub-tree
+ * gets unit labels for each of its files, so every file beneath keeps unit - 1
+ * labels for children created later, however deep it is, and the file keeps
+ * the rest.
+ */
+static void file_relabel(struct file* file, unsigned long enter,
+						 unsigned long leave, unsigned long unit) {
+	file->enter = enter;
+	file->leave = leave;
+	file->next = enter + 1;
+	list_traverse(file->l_children, &unit, &file_relabel_aux);
+}
+
+/*
+ * Relabels a file's sub-tree within the file's own interval, so no other file
+ * changes. Half of the labels are shared by its files, if there are enough,
+ * and the other half is left to the file for children created later.
+ */
+static void file_relabel_within(struct fs* fs, struct file* file) {
+	unsigned long size = file->leave - file->enter;
+	unsigned long unit = size / 2 / file->usage.files;
+
+	if (unit == 0)
+		unit = size / file->usage.files;
+	file_relabel(file, file->enter, file->leave, unit);
+	fs->touched += file->usage.files;
+}
+
+/*
+ * Relabels the smallest sub-tree holding a file which has at least
+ * 2^FILE_ROOM_SHIFT labels for each of its files, or the whole tree if none
+ * has. Afterwards every file in it has at least half as many labels left for
+ * new children, so it is only relabeled again after many files were created
+ * in it, and creating files in one sub-tree never relabels the others.
+ */
+static void file_make_room(struct fs* fs, struct file* file) {
+	while (file->parent != NULL && (file->leave - file->enter) >>
+		   FILE_ROOM_SHIFT < (unsigned long)file->usage.files)
+		file = file->parent;
+	file_relabel_within(fs, file);
+}
+
 /* Creates a filesystem. Returns NULL if the memory allocation failed. */
 struct fs* filesystem_create(void) {
 	struct fs* fs = calloc(1, sizeof(struct fs));
 	
 	/* Allocate root file */
-	fs->root = file_alloc("", 0);
+	fs->root = file_alloc("", 0, 0);
 	if (fs->root == NULL) {
 		free(fs);
 		return NULL;
 	}
+	fs->root->leave = ~0ul; /* Every label */
+	fs->root->next = 1;
+	fs->labeled = 1;
 
 	/* Create the hash table used to search files by value */
 	fs->value_table = table_create();
@@ -104,87 +419,535 @@ struct fs* filesystem_create(void) {
 		return NULL;
 	}
 
+	/* Create the ordered index used to search files by value prefix */
+	fs->value_index = index_create();
+	if (fs->value_index == NULL) {
+		table_destroy(fs->value_table);
+		file_free(fs->root);
+		free(fs);
+		return NULL;
+	}
+
+	/* Create the list of deleted sub-trees which weren't freed yet */
+	fs->pending = list_create();
+	if (fs->pending == NULL) {
+		index_destroy(fs->value_index);
+		table_destroy(fs->value_table);
+		file_free(fs->root);
+		free(fs);
+		return NULL;
+	}
+
 	return fs;
 }
 
+/* Returns the root file of a filesystem. */
+struct file* filesystem_root(struct fs* fs) {
+	return fs->root;
+}
+
+/* Returns the current time of a filesystem (number of files created). */
+int filesystem_time(struct fs* fs) {
+	return fs->time;
+}
+
+/*
+ * Sets the current time of a filesystem. The next file created will have a
+ * creation time of time + 1.
+ */
+void filesystem_set_time(struct fs* fs, int time) {
+	fs->time = time;
+}
+
+/*
+ * Packs values set from now on with at least length characters, see
+ * value_pack. Packing is disabled if length is 0.
+ */
+void filesystem_set_packing(struct fs* fs, int length) {
+	fs->pack_length = length;
+}
+
+/*
+ * Lets concurrent writers set values on a filesystem (see writer.c), if shared
+ * is 1. Nothing else may read or change it until they are done and
+ * filesystem_settle is called.
+ */
+void filesystem_set_shared(struct fs* fs, int shared) {
+	fs->shared = shared;
+}
+
+/* Brings the digests up to date after concurrent writers are done. */
+void filesystem_settle(struct fs* fs) {
+	file_settle(fs->root);
+}
+
+/* Returns the shortest value packed in a filesystem, 0 if not packing. */
+int filesystem_packing(struct fs* fs) {
+	return fs->pack_length;
+}
+
+/* Returns the number of packed values in a filesystem. */
+int filesystem_packed(struct fs* fs) {
+	return fs->packed;
+}
+
+/* Returns the number of bytes saved by packing values in a filesystem. */
+int filesystem_saved(struct fs* fs) {
+	return fs->saved;
+}
+
 /* Deletes a filesystem and frees all memory associated with it. */
 void filesystem_destroy(struct fs* fs) {
-	file_delete(fs, fs->root);
+	file_delete(fs, NULL);
+	filesystem_reclaim(fs, -1); /* Free every deleted file */
+	file_free(fs->root);
+	list_destroy(fs->pending);
 	table_destroy(fs->value_table);
+	index_destroy(fs->value_index);
 	free(fs);
 }
 
+/*
+ * Creates the files missing on a path for concurrent writers, see file_create.
+ * Each directory is searched and changed with its lock held, and takes its
+ * creation time there, so times still follow the order files were created in.
+ * Digests are only marked out of date.
+ */
+static struct file* file_create_shared(struct fs* fs, const struct path* path) {
+	struct file* file, * root = fs->root;
+	const struct component* comp = path->components;
+	const struct component* end = comp + path->count;
+
+	for (; comp != end; ++comp, root = file) {
+		ADD(fs->touched, 1);
+		lock_acquire(&root->lock);
+		file = avl_find(root->avl_children, comp->start, comp->length);
+		if (file == NULL &&
+			(file = file_alloc(comp->start, comp->length,
+							   __atomic_add_fetch(&fs->time, 1,
+												  __ATOMIC_SEQ_CST))) != NULL) {
+			if (file_add(root, file)) {
+				if (!file_label(root, file))
+					STORE(fs->labeled, 0); /* See file_search_within */
+				ADD(fs->files, 1);
+				file_update_usage(fs, root, 1, 0, 0);
+				file_mark_digest(root);
+			}
+			else {
+				file_free(file);
+				file = NULL;
+			}
+		}
+		lock_release(&root->lock);
+		if (file == NULL)
+			return NULL; /* Allocation failed */
+	}
+
+	return root;
+}
+
 /*
  * Creates a new file on a path with a NULL value. If a file already exists,
  * the old file is returned unchanged. Returns NULL if the memory allocation
  * failed.
  */
-struct file* file_create(struct fs* fs, char* path) {
-	struct file* file, * root = fs->root;
-	const char* comp;
+struct file* file_create(struct fs* fs, const struct path* path) {
+	struct file* file, * root = fs->root, * first = NULL;
+	const struct component* comp = path->components;
+	const struct component* end = comp + path->count;
+	int labeled = 1;
+
+	if (fs->shared)
+		return file_create_shared(fs, path);
 
 	/* For each component in path, find file or create one if none is found */
-	for (comp = strtok(path, "/"); comp != NULL; comp = strtok(NULL, "/")) {
-		file = avl_find(root->avl_children, comp);
+	for (; comp != end; ++comp) {
+		++fs->touched;
+		file = avl_find(root->avl_children, comp->start, comp->length);
 		if (file != NULL) /* File already exists */
 			root = file;
 		else { /* File not found, create it */
-			if ((file = file_alloc(comp, ++fs->time)) == NULL)
-				return NULL; /* Allocation failed */
+			file = file_alloc(comp->start, comp->length, ++fs->time);
+			if (file == NULL)
+				break; /* Allocation failed */
 
 			if (!file_add(root, file)) { /* Add file to parent */
 				file_free(file);
-				return NULL;
+				break;
 			}
+			if (!file_label(root, file))
+				labeled = 0; /* Relabeled once the sizes are updated */
+			++fs->files;
 
+			if (first == NULL)
+				first = file;
 			root = file;
 		}
 	}
 
-	return root;
+	/*
+	 * Each new file has a single child, so their digests and sizes are summed
+	 * from the bottom up before the ancestors which already existed are
+	 * updated once.
+	 */
+	if (first != NULL) {
+		for (file = root; file != first; file = file->parent) {
+			file->parent->digest += file_mix(file->digest);
+			file->parent->usage.files += file->usage.files;
+		}
+		file_update_digest(first->parent,
+						   first->parent->digest + file_mix(first->digest));
+		file_update_usage(fs, first->parent, first->usage.files, 0, 0);
+		if (!labeled && fs->labeled)
+			file_make_room(fs, first->parent);
+	}
+
+	return comp == end ? root : NULL;
+}
+
+/* Growable array of files collected by a search or a deletion. */
+struct file_array {
+	struct file** files;
+	int count;
+};
+
+/*
+ * Appends a file to an array. The array's capacity is the smallest power of
+ * two, not below 16, which holds its files. Returns 0 if memory allocation
+ * failed, otherwise returns 1.
+ */
+static int file_array_push(struct file_array* array, struct file* file) {
+	struct file** files;
+	int count = array->count;
+
+	if (count == 0 || (count >= 16 && (count & (count - 1)) == 0)) {
+		files = realloc(array->files, (count < 16 ? 16 : count * 2) *
+									  sizeof(struct file*)); /* Grow array */
+		if (files == NULL)
+			return 0; /* Allocation failed */
+		array->files = files;
+	}
+
+	array->files[array->count++] = file;
+	return 1;
 }
 
 /*
- * Delete a file and its children, removing it from the tree and freeing the
- * memory associated with it. If file is NULL, every file except the root is
+ * Auxiliar function to file_delete, marks a file and its sub-tree deleted and
+ * appends the ones with a value to the array. Once an allocation fails, the
+ * array's count is set to -1 and no more files are appended.
+ */
+static void* file_delete_aux(void* array_v, struct file* file) {
+	struct file_array* array = array_v;
+
+	file->deleted = 1;
+	if (file->value != NULL && array->count >= 0 &&
+		!file_array_push(array, file))
+		array->count = -1; /* Allocation failed */
+	return list_traverse(file->l_children, array, &file_delete_aux);
+}
+
+/*
+ * Auxiliar function to file_delete, removes a file and its sub-tree from the
+ * value table and index one file at a time. Used when the files couldn't be
+ * collected to be removed in batches.
+ */
+static void* file_unlink_aux(void* fs_v, struct file* file) {
+	struct fs* fs = fs_v;
+
+	if (file->value != NULL) {
+		table_remove(fs->value_table, file);
+		index_remove(fs->value_index, file);
+	}
+	return list_traverse(file->l_children, fs, &file_unlink_aux);
+}
+
+/*
+ * Delete a file and its children, removing it from the tree and from the value
+ * table and index. If file is NULL (or the root), every file except the root is
  * deleted.
+ *
+ * Every file of the sub-tree is marked deleted and removed from the value table
+ * and index here, sweeping each bucket and index node with a deleted value
+ * once, so this takes O(n log n + c) time for n files with values and c files
+ * in the buckets swept. Only freeing the sub-tree is deferred: it is queued to
+ * be freed in bounded increments by filesystem_reclaim.
  */
 void file_delete(struct fs* fs, struct file* file) {
+	struct file_array array;
 	struct file* child, * parent;
 
-	if (file == NULL) {
+	if (file == NULL || file->parent == NULL) {
 		/* Delete every non-root file */
 		while ((child = list_first(fs->root->l_children)) != NULL)
 			file_delete(fs, child);
+		return;
+	}
+
+	parent = file->parent;
+	file_update_digest(parent, parent->digest - file_mix(file->digest));
+	file_update_usage(fs, parent, -file->usage.files, -file->usage.values,
+					  -file->usage.bytes);
+	table_remove(fs->value_table, file); /* Remove file from value table */
+	index_remove(fs->value_index, file); /* Remove file from value index */
+
+	/* Remove its descendants as well, see file_alive */
+	array.files = NULL;
+	array.count = 0;
+	file->deleted = 1;
+	list_traverse(file->l_children, &array, &file_delete_aux);
+	if (array.count > 0) {
+		table_remove_deleted(fs->value_table, array.files, array.count);
+		index_remove_deleted(fs->value_index, array.files, array.count);
 	}
-	else {
-		/* Delete children first */
+	else if (array.count < 0) /* Allocation failed */
+		list_traverse(file->l_children, fs, &file_unlink_aux);
+	free(array.files);
+
+	/* Remove file from its parent */
+	parent->avl_children = avl_remove(parent->avl_children, file);
+	list_remove(parent->l_children, file->l_self);
+
+	/* Queue the detached sub-tree to be freed, l_self now points there */
+	file->parent = NULL;
+	if ((file->l_self = list_insert(fs->pending, file)) == NULL)
+		file_reclaim_tree(fs, file); /* Allocation failed, free it now */
+	else
+		++fs->pending_count;
+}
+
+/*
+ * Frees up to count files from the deleted sub-trees, or every one of them if
+ * count is -1. Files are freed children first. Returns the number of files
+ * freed.
+ */
+int filesystem_reclaim(struct fs* fs, int count) {
+	struct file* file, * child;
+	int freed = 0;
+
+	while (freed != count && (file = list_first(fs->pending)) != NULL) {
+		/* Go down to a file without children */
 		while ((child = list_first(file->l_children)) != NULL)
-			file_delete(fs, child);
-		parent = file->parent;
+			file = child;
 
-		/* Remove file from its parent */
-		if (parent != NULL) {
-			parent->avl_children = avl_remove(parent->avl_children, file);
-			list_remove(parent->l_children, file->l_self);
+		/*
+		 * The parent is being freed as well, so it is enough to remove the file
+		 * from its list, the AVL nodes are freed with the parent.
+		 */
+		if (file->parent == NULL) {
+			list_remove(fs->pending, file->l_self);
+			--fs->pending_count;
 		}
+		else
+			list_remove(file->parent->l_children, file->l_self);
+
+		file_reclaim(fs, file);
+		++freed;
+	}
+
+	return freed;
+}
 
-		table_remove(fs->value_table, file); /* Remove file from value table */
-		file_free(file); /* Free memory */
+/* State of a compaction, see filesystem_compact. */
+struct compaction {
+	struct block* block;	/* Block where files are moved */
+	char* chars;			/* Where the next component or value is copied */
+	struct file* parent;	/* Moved parent of the files being moved */
+	int files;				/* Files counted or moved so far */
+	size_t size;			/* Bytes of components and values counted */
+};
+
+/* Returns the number of bytes taken by a file's value. */
+static int file_value_size(struct file* file) {
+	if (file->value == NULL)
+		return 0;
+	return file->packed ? value_size(file->value) :
+						  (int)strlen(file->value) + 1;
+}
+
+/* Auxiliar function to filesystem_compact, counts a file's sub-tree. */
+static void* file_measure(void* compaction_v, struct file* file) {
+	struct compaction* compaction = compaction_v;
+
+	++compaction->files;
+	compaction->size += strlen(file->component) + 1 + file_value_size(file);
+	return list_traverse(file->l_children, compaction, &file_measure);
+}
+
+/*
+ * Auxiliar function to filesystem_compact, copies a file and its sub-tree to
+ * the next files in the block, under the parent copied last. The copies have
+ * no children yet.
+ */
+static void* file_move(void* compaction_v, struct file* file) {
+	struct compaction* compaction = compaction_v;
+	struct file* moved = &compaction->block->files[compaction->files++];
+	struct file* parent = compaction->parent;
+	int length = strlen(file->component) + 1, size = file_value_size(file);
+	void* ret;
+
+	*moved = *file;
+	moved->block = compaction->block;
+	moved->parent = parent;
+	moved->avl_children = NULL;
+	moved->l_children = NULL;
+	moved->l_self = NULL;
+	moved->component = memcpy(compaction->chars, file->component, length);
+	compaction->chars += length;
+	if (file->value != NULL) {
+		moved->value = memcpy(compaction->chars, file->value, size);
+		moved->block_value = 1;
+		compaction->chars += size;
 	}
+
+	/* Children are copied in creation order, right after their parent */
+	compaction->parent = moved;
+	ret = list_traverse(file->l_children, compaction, &file_move);
+	compaction->parent = parent;
+	return ret;
+}
+
+/*
+ * Auxiliar function to filesystem_compact, adds a copied file to its parent's
+ * children and to the value table and index. Returns 0 if a memory allocation
+ * failed, otherwise returns 1.
+ */
+static int file_link(struct fs* fs, struct file* file) {
+	if (file->l_children == NULL && (file->l_children = list_create()) == NULL)
+		return 0; /* Allocation failed */
+	if (file->parent != NULL && !file_add(file->parent, file)) {
+		list_destroy(file->l_children);
+		file->l_children = NULL;
+		return 0; /* Allocation failed */
+	}
+
+	++file->block->live;
+	return file->value == NULL || (table_insert(fs->value_table, file) &&
+								   index_insert(fs->value_index, file));
+}
+
+/*
+ * Frees a file and its sub-tree, without removing them from the value table
+ * and index, which are freed as well.
+ */
+static void file_free_tree(struct file* file) {
+	struct file* child;
+
+	while ((child = list_first(file->l_children)) != NULL) {
+		list_remove(file->l_children, child->l_self);
+		file_free_tree(child);
+	}
+	file_free(file);
+}
+
+/*
+ * Moves every file, with its component and value, into a single block in DFS
+ * order. Deleted files are freed first, and the old files and everything built
+ * around them are freed before the children of each file, the value table and
+ * the index are rebuilt, so that the memory left scattered by deletes can be
+ * returned to the system and later traversals read memory in order. Returns 0
+ * if a memory allocation failed. In that case, the filesystem is left as it
+ * was if the block couldn't be allocated, otherwise it may be missing files,
+ * and it should only be destroyed.
+ */
+int filesystem_compact(struct fs* fs) {
+	struct compaction compaction = { NULL, NULL, NULL, 0, 0 };
+	struct table* table;
+	struct index* index;
+	struct list* children;
+	int i, files;
+
+	filesystem_reclaim(fs, -1); /* Free every deleted file */
+	file_measure(&compaction, fs->root);
+	files = compaction.files;
+	compaction.block = malloc(sizeof(struct block) + (files - 1) *
+							  sizeof(struct file) + compaction.size);
+	table = table_create();
+	index = index_create();
+	children = list_create(); /* The root's, so it can always be destroyed */
+	if (compaction.block == NULL || table == NULL || index == NULL ||
+		children == NULL) {
+		free(compaction.block); /* Allocation failed */
+		if (table != NULL)
+			table_destroy(table);
+		if (index != NULL)
+			index_destroy(index);
+		if (children != NULL)
+			list_destroy(children);
+		return 0;
+	}
+
+	compaction.block->live = 0;
+	compaction.chars = (char*)&compaction.block->files[files];
+	compaction.files = 0;
+	file_move(&compaction, fs->root);
+
+	/* Nothing refers to the old files anymore */
+	file_free_tree(fs->root);
+	table_destroy(fs->value_table);
+	index_destroy(fs->value_index);
+#ifdef __GLIBC__
+	malloc_trim(0); /* Gather the freed memory, returning what it can */
+#endif
+
+	/* Parents come first, so files are indexed in the order they're printed */
+	fs->root = compaction.block->files;
+	fs->root->l_children = children;
+	fs->value_table = table;
+	fs->value_index = index;
+	fs->touched += files;
+	for (i = 0; i < files; ++i)
+		if (!file_link(fs, &compaction.block->files[i]))
+			return 0; /* Allocation failed */
+
+	return 1;
+}
+
+/* Returns the number of deleted sub-trees which weren't fully freed yet. */
+int filesystem_pending(struct fs* fs) {
+	return fs->pending_count;
+}
+
+/* Returns the number of files allocated, including deleted ones not freed. */
+int filesystem_files(struct fs* fs) {
+	return fs->files;
+}
+
+/*
+ * Returns the number of files visited so far by path lookups, prints and
+ * frees, used to trace how much work each command does.
+ */
+int filesystem_touched(struct fs* fs) {
+	return LOAD(fs->touched);
+}
+
+/* Returns the number of deleted files freed so far. */
+int filesystem_reclaimed(struct fs* fs) {
+	return fs->reclaimed;
+}
+
+/*
+ * Returns 1 if a file is still in the tree, or 0 if it belongs to a deleted
+ * sub-tree waiting to be freed. file_delete marks every file of the sub-tree,
+ * so this takes constant time.
+ */
+int file_alive(struct file* file) {
+	return !file->deleted;
 }
 
 /*
  * Tries to find a file from its path. Returns a pointer to the file, and, if no
  * file was found, NULL is returned.
  */
-struct file* file_find(struct fs* fs, char* path) {
+struct file* file_find(struct fs* fs, const struct path* path) {
 	struct file* file = fs->root;
-	const char* comp;
+	const struct component* comp = path->components;
+	const struct component* end = comp + path->count;
 
 	/* For each component in the path find a children file */
-	for (comp = strtok(path, "/"); comp != NULL; comp = strtok(NULL, "/")) {
-		file = avl_find(file->avl_children, comp);
+	for (; comp != end; ++comp) {
+		++fs->touched;
+		file = avl_find(file->avl_children, comp->start, comp->length);
 		if (file == NULL)
 			return NULL;
 	}
@@ -197,7 +960,7 @@ struct file* file_find(struct fs* fs, char* path) {
  * NULL is returned. Otherwise, a pointer to the file is returned.
  */
 void* file_search_aux(void* value, struct file* root) {
-	if (root->value != NULL && strcmp(value, root->value) == 0)
+	if (root->value != NULL && strcmp(value, file_value(root)) == 0)
 		return root;
 	return list_traverse(root->l_children, value, &file_search_aux);
 }
@@ -211,22 +974,229 @@ struct file* file_search(struct fs* fs, char* value) {
 }
 
 /*
- * Sets an existing file's value or adds a new file with that value on the
- * specified path. Returns a pointer to the file whose value was changed. If
- * a memory allocation fails, NULL is returned. 
+ * Brings every label up to date. Concurrent writers can't relabel a sub-tree
+ * without locking it, so when they run out of labels the whole tree is
+ * relabeled here, once.
+ */
+static void file_settle_labels(struct fs* fs) {
+	if (!fs->labeled) {
+		file_relabel_within(fs, fs->root);
+		fs->labeled = 1;
+	}
+}
+
+/* State of a search beneath a file, see file_search_within. */
+struct scoped_search {
+	struct file* scope;		/* File the search is limited to */
+	struct file* best;		/* First match found so far in DFS order */
+};
+
+/*
+ * Auxiliar function to file_search_within, keeps the first match beneath the
+ * scope, comparing labels in constant time.
  */
-struct file* file_set(struct fs* fs, char* path, char* value) {
+static void* file_search_within_aux(void* search_v, struct file* file) {
+	struct scoped_search* search = search_v;
+	struct file* scope = search->scope;
+
+	if (file->enter < scope->enter || file->enter >= scope->leave ||
+		(search->best != NULL && file->enter > search->best->enter))
+		return NULL;
+
+	search->best = file;
+	return NULL;
+}
+
+/*
+ * Searches a file by value beneath a file, including the file itself. Only the
+ * files with the value are checked, each in constant time, once the labels
+ * are up to date (see file_settle_labels). If the file is not found, NULL is
+ * returned. Otherwise, the first one in the print command is returned.
+ */
+struct file* file_search_within(struct fs* fs, const char* value,
+								struct file* scope) {
+	struct scoped_search search;
+
+	file_settle_labels(fs);
+	search.scope = scope;
+	search.best = NULL;
+	table_traverse(fs->value_table, value, &search, &file_search_within_aux);
+	return search.best;
+}
+
+/*
+ * Auxiliar function for searching files by value or value prefix, appends each
+ * file found to the array. Ends the traversal early if an allocation fails.
+ */
+static void* file_append_aux(void* array_v, struct file* file) {
+	return file_array_push(array_v, file) ? NULL : array_v;
+}
+
+/*
+ * Appends every file whose value starts with prefix to the array *files, which
+ * holds *count files and must have been allocated by this function (or be
+ * NULL). The files appended are not sorted, but their labels are brought up
+ * to date for file_sort. Returns 0 if a memory allocation failed, otherwise
+ * returns 1.
+ */
+int file_search_prefix(struct fs* fs, const char* prefix, struct file*** files,
+					   int* count) {
+	struct file_array array;
+	void* failed;
+
+	file_settle_labels(fs);
+	array.files = *files;
+	array.count = *count;
+
+	/* The index only visits matching values, so this is O(log n + matches) */
+	failed = index_traverse_prefix(fs->value_index, prefix, &array,
+								   &file_append_aux);
+
+	*files = array.files;
+	*count = array.count;
+	return failed == NULL;
+}
+
+/*
+ * Deletes every file with a value, with the paths beneath them. The matches
+ * are found in the value table and deleted in DFS order, so a match beneath
+ * another one has already been deleted with it when it is reached, and is
+ * skipped. They are all removed from the value table and index first, each in
+ * a single pass, so deleting them doesn't search for each one there. Returns
+ * the number of files deleted, not counting the ones beneath them, or -1 if a
+ * memory allocation failed, in which case nothing is deleted.
+ */
+int file_delete_value(struct fs* fs, const char* value) {
+	struct file_array array = { NULL, 0 };
+	int i, deleted = 0;
+
+	if (table_traverse(fs->value_table, value, &array,
+					   &file_append_aux) != NULL) {
+		free(array.files);
+		return -1; /* Allocation failed */
+	}
+
+	file_settle_labels(fs);
+	if (!file_sort(array.files, array.count)) { /* Ancestors come first */
+		free(array.files);
+		return -1; /* Allocation failed */
+	}
+
+	if (array.count > 0) {
+		table_remove_value(fs->value_table, value);
+		index_remove_value(fs->value_index, value);
+	}
+
+	for (i = 0; i < array.count; ++i)
+		if (file_alive(array.files[i])) {
+			file_delete(fs, array.files[i]);
+			++deleted;
+		}
+
+	free(array.files);
+	return deleted;
+}
+
+/*
+ * Sort key of a file, see file_sort. Files on different filesystems (see
+ * shard.c) are ordered by their top-level ancestors, which have globally
+ * consistent creation times, and files under the same one by their labels.
+ */
+struct file_key {
+	int top;				/* Creation time of the top-level ancestor */
+	unsigned long label;	/* First label of the file, see file_label */
+	struct file* file;
+};
+
+/* Compares two sort keys, used by file_sort. */
+static int file_key_cmp(const void* lhs_v, const void* rhs_v) {
+	const struct file_key* lhs = lhs_v, * rhs = rhs_v;
+
+	if (lhs->top != rhs->top)
+		return lhs->top < rhs->top ? -1 : 1;
+	if (lhs->label != rhs->label)
+		return lhs->label < rhs->label ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sorts an array of files by the order shown in the print command. The labels
+ * of their filesystems must be up to date, which file_search_prefix ensures.
+ * Each file's key is found once, in time proportional to its height, so
+ * sorting k files takes O(k log k) constant time comparisons, instead of
+ * walking up the tree in each one (see file_compare). Returns 0 if a memory
+ * allocation failed, otherwise returns 1.
+ */
+int file_sort(struct file** files, int count) {
+	struct file_key* keys;
+	struct file* top;
+	int i;
+
+	if (count < 2)
+		return 1;
+	if ((keys = malloc(count * sizeof(struct file_key))) == NULL)
+		return 0; /* Allocation failed */
+
+	for (i = 0; i < count; ++i) {
+		top = files[i];
+		while (top->height > 1)
+			top = top->parent;
+		keys[i].top = top->time;
+		keys[i].label = files[i]->enter;
+		keys[i].file = files[i];
+	}
+	qsort(keys, count, sizeof(struct file_key), &file_key_cmp);
+	for (i = 0; i < count; ++i)
+		files[i] = keys[i].file;
+
+	free(keys);
+	return 1;
+}
+
+/*
+ * Sets an existing file's value, the first length characters of value, or adds
+ * a new file with that value on the specified path. Returns a pointer to the
+ * file whose value was changed. If a memory allocation fails, NULL is
+ * returned. 
+ */
+struct file* file_set(struct fs* fs, const struct path* path, const char* value,
+					  int length) {
 	struct file* file = file_create(fs, path);
+	unsigned long children;
+	const char* old;
+	int values, bytes;
 
 	if (file != NULL) {
 		table_remove(fs->value_table, file);
+		index_remove(fs->value_index, file);
 
-		if ((file->value = realloc(file->value, strlen(value) + 1)) == NULL)
+		/* Replace the hash and the size of the old value */
+		old = file_value(file);
+		children = file->digest - file_hash_self(file->component, old);
+		values = old == NULL;
+		bytes = length - (old == NULL ? 0 : (int)strlen(old));
+		file_unpacked(fs, file);
+		if (file->block_value)
+			file_free_value(file); /* Values can't grow in their block */
+		if ((file->value = realloc(file->value, length + 1)) == NULL)
 			return NULL; /* Allocation failed */
-		strcpy(file->value, value);
+		memcpy(file->value, value, length);
+		file->value[length] = '\0';
+		file->value_hash = value_hash(file->value);
+		if (fs->shared)
+			file_mark_digest(file);
+		else
+			file_update_digest(file, children +
+							   file_hash_self(file->component, file->value));
+		file_update_usage(fs, file, 0, values, bytes);
 
 		if (!table_insert(fs->value_table, file))
 			return NULL; /* Allocation failed */
+		if (!index_insert(fs->value_index, file))
+			return NULL; /* Allocation failed */
+
+		/* Packed last, so that the value is only hashed and copied raw */
+		file_pack(fs, file, length);
 	}
 
 	return file;
@@ -237,23 +1207,25 @@ void file_print_path(struct file* root) {
 	if (root->parent == NULL)
 		return;
 	file_print_path(root->parent);
-	printf("/%s", root->component);
+	output_char('/');
+	output_str(root->component);
 }
 
-/* Auxiliar function which prints each path and value */
-void* file_print_aux(void* unused, struct file* file) {
-	/*
-	 * Supress unused parameter warning, must be done to avoid having to create
-	 * another function pointer type and traversal function.
-	 */
-	(void)unused;
-		
+/*
+ * Auxiliar function which prints each path and value, counting the files
+ * printed on the filesystem passed (if not NULL).
+ */
+void* file_print_aux(void* fs_v, struct file* file) {
+	struct fs* fs = fs_v;
+
+	if (fs != NULL)
+		++fs->touched;
 	if (file->value != NULL) {
 		file_print_path(file);
-		putchar(' ');
-		puts(file->value);
+		output_char(' ');
+		output_puts(file_value(file));
 	}
-	list_traverse(file->l_children, NULL, &file_print_aux);
+	list_traverse(file->l_children, fs, &file_print_aux);
 	return NULL;
 }
 
@@ -262,7 +1234,25 @@ void* file_print_aux(void* unused, struct file* file) {
  * time.
  */
 void file_print(struct fs* fs) {
-	list_traverse(fs->root->l_children, NULL, &file_print_aux);
+	list_traverse(fs->root->l_children, fs, &file_print_aux);
+}
+
+/*
+ * Prints the path and value of a file and all files beneath it, counting the
+ * files printed on the filesystem passed (if not NULL).
+ */
+void file_print_tree(struct fs* fs, struct file* file) {
+	file_print_aux(fs, file);
+}
+
+/*
+ * Traverses the files immediately beneath a file, sorted by creation time.
+ * fn(ptr, file) is called for each one. If fn(ptr, file) returns a non-NULL
+ * value, the traversal ends early and that value is returned. Otherwise, NULL
+ * is returned.
+ */
+void* file_traverse(struct file* file, void* ptr, traverse_fn fn) {
+	return list_traverse(file->l_children, ptr, fn);
 }
 
 /* Auxiliar function which prints each file traversed */
@@ -273,7 +1263,7 @@ void* file_list_aux(void* unused, struct file* file) {
 	 */
 	(void)unused;
 
-	puts(file->component);
+	output_puts(file->component);
 	return NULL;
 }
 
@@ -285,9 +1275,33 @@ void file_list(struct file* file) {
 	avl_traverse(file->avl_children, NULL, &file_list_aux);
 }
 
-/* Returns a file's value. May be NULL. */
+/*
+ * Returns a file's value. May be NULL. Packed values are unpacked, and are
+ * only valid until the next value is unpacked on the same thread.
+ */
 const char* file_value(struct file* file) {
-	return file->value;
+	return file->packed ? value_unpack(file->value) : file->value;
+}
+
+/* Returns 1 if a file has a value, without unpacking it, 0 otherwise. */
+int file_has_value(struct file* file) {
+	return file->value != NULL;
+}
+
+/* Returns the hash of a file's value, which must not be NULL. */
+unsigned int file_value_hash(struct file* file) {
+	return file->value_hash;
+}
+
+/*
+ * Gets the sizes of a file's sub-tree, which are kept up to date as files are
+ * created, set and deleted, so this takes constant time. The root isn't
+ * counted as a file.
+ */
+void file_usage(struct file* file, struct usage* usage) {
+	*usage = file->usage;
+	if (file->parent == NULL)
+		--usage->files;
 }
 
 /* Returns a file's path component. */
@@ -310,4 +1324,94 @@ int file_time(struct file* file) {
 /* Returns a file's height on the filesystem. */
 int file_height(struct file* file) {
 	return file->height;
+}
+
+/*
+ * Returns the digest of a file's sub-tree, a Merkle hash of its component,
+ * value and the digests of its children. Children are summed, so the digest
+ * doesn't depend on the order in which they were created, and two sub-trees
+ * with the same paths and values have the same digest. It is kept up to date
+ * by every change made beneath the file.
+ */
+unsigned long file_digest(struct file* file) {
+	return file->digest;
+}
+
+/*
+ * Returns the digest the root would have with the top-level files passed, as
+ * file_digest does for the root. Used to combine the roots of several
+ * filesystems (see shard.c).
+ */
+unsigned long file_digest_files(struct file** top, int count) {
+	unsigned long digest = file_hash_self("", NULL);
+	int i;
+
+	for (i = 0; i < count; ++i)
+		digest += file_mix(top[i]->digest);
+	return digest;
+}
+
+/* Auxiliar function which counts the files traversed. */
+static void* file_count_aux(void* count_v, struct file* file) {
+	(void)file; /* Supress unused parameter warning */
+	++*(int*)count_v;
+	return NULL;
+}
+
+/* Auxiliar function which collects the files traversed. */
+static void* file_collect_aux(void* end_v, struct file* file) {
+	struct file*** end = end_v;
+
+	*(*end)++ = file;
+	return NULL;
+}
+
+/*
+ * Collects the files immediately beneath a file, sorted lexicographically.
+ * Returns NULL if the memory allocation failed, otherwise the array must be
+ * freed by the caller. *count is set to the number of files.
+ */
+struct file** file_children(struct file* file, int* count) {
+	struct file** files, ** end;
+
+	*count = 0;
+	avl_traverse(file->avl_children, count, &file_count_aux);
+	if ((files = malloc((*count + 1) * sizeof(struct file*))) == NULL)
+		return NULL; /* Allocation failed */
+
+	end = files;
+	avl_traverse(file->avl_children, &end, &file_collect_aux);
+	return files;
+}
+
+/*
+ * Compares two files by the order shown in the print command (DFS, sorted by
+ * creation time). Returns a negative value if lhs comes first, a positive
+ * value if rhs comes first and 0 if both are the same file.
+ */
+int file_compare(struct file* lhs, struct file* rhs) {
+	struct file* lhs_p = lhs, * rhs_p = rhs;
+
+	/* Put files on the same height */
+	while (lhs_p->height > rhs_p->height)
+		lhs_p = lhs_p->parent;
+	while (rhs_p->height > lhs_p->height)
+		rhs_p = rhs_p->parent;
+
+	/* One of the files is an ancestor of the other, so it comes first */
+	if (lhs_p == rhs_p)
+		return lhs->height - rhs->height;
+
+	/*
+	 * Go down until the parent is the same but the file is not. Files on
+	 * different filesystems (see shard.c) are compared by their top-level
+	 * ancestors, which have globally consistent creation times.
+	 */
+	while (lhs_p->parent != rhs_p->parent && lhs_p->height > 1) {
+		lhs_p = lhs_p->parent;
+		rhs_p = rhs_p->parent;
+	}
+
+	/* Compare creation time */
+	return lhs_p->time - rhs_p->time;
 }
\ No newline at end of file
@@ -0,0 +1,709 @@
+/*
+ * File: 		image.c
+ * Author: 		Ricardo Antunes
+ * Description: Read-only filesystem image, exported to a file which is later
+ * 				memory mapped to answer read commands without rebuilding the
+ * 				filesystem.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/*
+ * Layout of an image file. Every field is an unsigned int (32 bits) and every
+ * reference is an offset or index instead of a pointer, so the file can be
+ * mapped anywhere. Files are stored as nodes in the order shown in the print
+ * command (DFS, sorted by creation time), with the root as node 0, so the
+ * first match of a value is the one with the lowest node index.
+ */
+struct image_header {
+	char magic[4];				/* IMAGE_MAGIC */
+	unsigned int version;		/* IMAGE_VERSION */
+	unsigned int size;			/* Size of the whole file */
+	unsigned int node_count;	/* Number of nodes, including the root */
+	unsigned int bucket_count;	/* Number of value hash buckets (power of 2) */
+	unsigned int nodes;			/* Offset of the node array */
+	unsigned int children;		/* Offset of the sorted children array */
+	unsigned int buckets;		/* Offset of the bucket array */
+	unsigned int entries;		/* Offset of the bucket entry array */
+	unsigned int strings;		/* Offset of the null terminated strings */
+};
+
+/* Describes a file in an image. */
+struct image_node {
+	unsigned int component;		/* String offset of the path component */
+	unsigned int value;			/* String offset of the value, or IMAGE_NONE */
+	unsigned int parent;		/* Parent node, or IMAGE_NONE for the root */
+	unsigned int end;			/* Node after the last one in the sub-tree */
+	unsigned int children;		/* First child in the sorted children array */
+	unsigned int child_count;	/* Number of children */
+	unsigned int digest[2];		/* Digest of the sub-tree, low half first */
+};
+
+/*
+ * Children are stored as node indexes, sorted lexicographically by component.
+ * Buckets hold bucket_count + 1 indexes into the entry array, where bucket i
+ * is entries[buckets[i]] to entries[buckets[i + 1] - 1], sorted by node. Each
+ * entry is the index of a node with a value hashing to that bucket.
+ */
+
+/* Describes a memory mapped image. */
+struct image {
+	const char* base;					/* Start of the mapping */
+	const struct image_header* header;	/* Header, at the start of the file */
+	const struct image_node* nodes;		/* Nodes, in print order */
+	const unsigned int* children;		/* Sorted children of every node */
+	const unsigned int* buckets;		/* Start of each bucket in entries */
+	const unsigned int* entries;		/* Nodes with values, by bucket */
+	const char* strings;				/* Components and values */
+};
+
+/* Every field of an image file must be 32 bits wide. */
+typedef char image_check_uint_size[sizeof(unsigned int) == 4 ? 1 : -1];
+
+/* Gets the hash of a string, used to place values in buckets. */
+static unsigned int image_hash(const char* v) {
+	unsigned int h = 0;
+
+	for (; *v != '\0'; ++v)
+		h = 31 * h + (unsigned char)*v;
+
+	return h;
+}
+
+/* Data used while an image is being built in memory. */
+struct image_builder {
+	struct image_header header;		/* Header, offsets are set last */
+	struct file** files;			/* Files, in print order (root is NULL) */
+	struct image_node* nodes;		/* Nodes, in print order */
+	unsigned int* children;			/* Sorted children array */
+	unsigned int* buckets;			/* Bucket array */
+	unsigned int* entries;			/* Bucket entry array */
+	char* strings;					/* Strings section */
+	struct image_child* sorted;		/* Used to sort the children of a node */
+	unsigned int count;				/* Nodes built so far */
+	unsigned int strings_size;		/* Bytes of strings so far */
+	unsigned int values;			/* Nodes with a value so far */
+};
+
+/* Used to sort children by component while building an image. */
+struct image_child {
+	const char* component;
+	unsigned int node;
+};
+
+/* Auxiliar function which counts the files and string bytes of an image. */
+static void* image_count_aux(void* builder_v, struct file* file) {
+	struct image_builder* builder = builder_v;
+	const char* value = file_value(file);
+
+	++builder->count;
+	builder->strings_size += strlen(file_component(file)) + 1;
+	if (value != NULL) {
+		builder->strings_size += strlen(value) + 1;
+		++builder->values;
+	}
+
+	return file_traverse(file, builder, &image_count_aux);
+}
+
+/* Auxiliar function which assigns nodes in print order to files. */
+static void* image_build_aux(void* builder_v, struct file* file) {
+	struct image_builder* builder = builder_v;
+	unsigned int node = builder->count++;
+
+	builder->files[node] = file;
+	file_traverse(file, builder, &image_build_aux);
+	builder->nodes[node].end = builder->count;
+
+	return NULL;
+}
+
+/* Compares two children by component. */
+static int image_child_cmp(const void* lhs, const void* rhs) {
+	return strcmp(((const struct image_child*)lhs)->component,
+				  ((const struct image_child*)rhs)->component);
+}
+
+/* Frees the memory used to build an image. */
+static void image_builder_free(struct image_builder* builder) {
+	free(builder->files);
+	free(builder->nodes);
+	free(builder->children);
+	free(builder->buckets);
+	free(builder->entries);
+	free(builder->strings);
+	free(builder->sorted);
+}
+
+/*
+ * Sizes an image holding the root and the top-level sub-trees passed and
+ * allocates its sections. Returns 0 if a memory allocation failed, otherwise
+ * returns 1. The builder must be freed in either case.
+ */
+static int image_builder_alloc(struct image_builder* builder,
+							   struct file** top, int count) {
+	struct image_header* header = &builder->header;
+	int i;
+
+	/* Count nodes, values and string bytes, starting with the root */
+	memset(builder, 0, sizeof(struct image_builder));
+	builder->count = builder->strings_size = 1;
+	for (i = 0; i < count; ++i)
+		image_count_aux(builder, top[i]);
+
+	memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+	header->version = IMAGE_VERSION;
+	header->node_count = builder->count;
+	for (header->bucket_count = 1; header->bucket_count < builder->values;)
+		header->bucket_count *= 2;
+
+	builder->files = malloc(header->node_count * sizeof(struct file*));
+	builder->nodes = calloc(header->node_count, sizeof(struct image_node));
+	builder->children = malloc(header->node_count * sizeof(unsigned int));
+	builder->buckets = calloc(header->bucket_count + 1, sizeof(unsigned int));
+	builder->entries = malloc((builder->values + 1) * sizeof(unsigned int));
+	builder->strings = malloc(builder->strings_size);
+	builder->sorted = malloc(header->node_count * sizeof(struct image_child));
+
+	return builder->files != NULL && builder->nodes != NULL &&
+		   builder->children != NULL && builder->buckets != NULL &&
+		   builder->entries != NULL && builder->strings != NULL &&
+		   builder->sorted != NULL;
+}
+
+/* Appends a string to the strings section, returning its offset. */
+static unsigned int image_add_string(struct image_builder* builder,
+									 const char* str) {
+	unsigned int offset = builder->strings_size, length = strlen(str) + 1;
+
+	memcpy(builder->strings + offset, str, length);
+	builder->strings_size += length;
+	return offset;
+}
+
+/* Stores a file's digest in a node, split in two halves. */
+static void image_set_digest(struct image_node* node, unsigned long digest) {
+	node->digest[0] = digest & 0xFFFFFFFFu;
+	node->digest[1] = digest >> 32;
+}
+
+/*
+ * Fills in the node array, the sorted children array and the strings section.
+ * Nodes are assigned in print order, so the children of a node are found by
+ * skipping from each child to the end of its sub-tree.
+ */
+static void image_build_nodes(struct image_builder* builder,
+							  struct file** top, int count) {
+	struct image_node* node, * nodes = builder->nodes;
+	unsigned int i, j, child, next = 0;
+	struct file* file;
+	const char* value;
+
+	builder->files[0] = NULL; /* The root has no file */
+	builder->count = 1;
+	for (i = 0; i < (unsigned int)count; ++i)
+		image_build_aux(builder, top[i]);
+	nodes[0].end = builder->count;
+
+	builder->strings[0] = '\0'; /* Component of the root */
+	builder->strings_size = 1;
+	nodes[0].parent = nodes[0].value = IMAGE_NONE;
+	image_set_digest(&nodes[0], file_digest_files(top, count));
+
+	for (i = 0; i < builder->count; ++i) {
+		node = &nodes[i];
+		if (i != 0) {
+			file = builder->files[i];
+			node->component = image_add_string(builder, file_component(file));
+			value = file_value(file);
+			node->value = value == NULL ? IMAGE_NONE :
+				image_add_string(builder, value);
+			image_set_digest(node, file_digest(file));
+		}
+
+		/* Collect and sort the children of the node */
+		for (child = i + 1; child < node->end; child = nodes[child].end) {
+			nodes[child].parent = i;
+			builder->sorted[node->child_count].component =
+				file_component(builder->files[child]);
+			builder->sorted[node->child_count++].node = child;
+		}
+		qsort(builder->sorted, node->child_count, sizeof(struct image_child),
+			  &image_child_cmp);
+
+		node->children = next;
+		for (j = 0; j < node->child_count; ++j)
+			builder->children[next++] = builder->sorted[j].node;
+	}
+}
+
+/*
+ * Fills in the bucket and entry arrays. Nodes are counted per bucket, and then
+ * placed using each bucket's start as a cursor, which keeps them in print
+ * order. The cursors end on the start of the next bucket, so they are shifted
+ * back afterwards.
+ */
+static void image_build_buckets(struct image_builder* builder) {
+	unsigned int i, mask = builder->header.bucket_count - 1;
+	unsigned int* buckets = builder->buckets;
+	struct image_node* nodes = builder->nodes;
+	const char* value;
+
+	for (i = 1; i < builder->count; ++i)
+		if (nodes[i].value != IMAGE_NONE) {
+			value = builder->strings + nodes[i].value;
+			++buckets[(image_hash(value) & mask) + 1];
+		}
+	for (i = 0; i < builder->header.bucket_count; ++i)
+		buckets[i + 1] += buckets[i];
+
+	for (i = 1; i < builder->count; ++i)
+		if (nodes[i].value != IMAGE_NONE) {
+			value = builder->strings + nodes[i].value;
+			builder->entries[buckets[image_hash(value) & mask]++] = i;
+		}
+	for (i = builder->header.bucket_count; i > 0; --i)
+		buckets[i] = buckets[i - 1];
+	buckets[0] = 0;
+}
+
+/*
+ * Writes a built image to a file. The image is written to a temporary file in
+ * the same directory, synced and then renamed over the file, so a failed or
+ * interrupted export leaves the previous image intact. Returns 0 if the file
+ * couldn't be written, otherwise returns 1.
+ */
+static int image_write(struct image_builder* builder, const char* filename) {
+	struct image_header* header = &builder->header;
+	unsigned int nodes = header->node_count;
+	unsigned int buckets = header->bucket_count + 1;
+	char* temp;
+	FILE* stream;
+	int fd, ok;
+
+	/* Sections follow the header, in the order they are declared */
+	header->nodes = sizeof(struct image_header);
+	header->children = header->nodes + nodes * sizeof(struct image_node);
+	header->buckets = header->children + nodes * sizeof(unsigned int);
+	header->entries = header->buckets + buckets * sizeof(unsigned int);
+	header->strings = header->entries + builder->values * sizeof(unsigned int);
+	header->size = header->strings + builder->strings_size;
+
+	/* The process ID keeps concurrent exports from sharing a temporary file */
+	if ((temp = malloc(strlen(filename) + IMAGE_TEMP_SUFFIX_SIZE)) == NULL)
+		return 0; /* Allocation failed */
+	sprintf(temp, "%s.%ld.tmp", filename, (long)getpid());
+	if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		free(temp);
+		return 0;
+	}
+	if ((stream = fdopen(fd, "wb")) == NULL) {
+		close(fd);
+		unlink(temp);
+		free(temp);
+		return 0;
+	}
+
+	ok = fwrite(header, sizeof(struct image_header), 1, stream) == 1 &&
+		fwrite(builder->nodes, sizeof(struct image_node), nodes,
+			   stream) == nodes &&
+		fwrite(builder->children, sizeof(unsigned int), nodes,
+			   stream) == nodes &&
+		fwrite(builder->buckets, sizeof(unsigned int), buckets,
+			   stream) == buckets &&
+		fwrite(builder->entries, sizeof(unsigned int), builder->values,
+			   stream) == builder->values &&
+		fwrite(builder->strings, 1, builder->strings_size,
+			   stream) == builder->strings_size &&
+		fflush(stream) == 0 && fsync(fd) == 0;
+
+	ok = fclose(stream) == 0 && ok && rename(temp, filename) == 0;
+	if (!ok)
+		unlink(temp);
+	free(temp);
+	return ok;
+}
+
+/*
+ * Exports an image holding the root and the sub-trees of the top-level files
+ * passed, which must be sorted by creation time. Returns 0 if the file couldn't
+ * be written or a memory allocation failed, otherwise returns 1.
+ */
+int image_export_files(const char* filename, struct file** top, int count) {
+	struct image_builder builder;
+	int ok = 0;
+
+	if (image_builder_alloc(&builder, top, count)) {
+		image_build_nodes(&builder, top, count);
+		image_build_buckets(&builder);
+		ok = image_write(&builder, filename);
+	}
+
+	image_builder_free(&builder);
+	return ok;
+}
+
+/* Auxiliar function which collects the top-level files of a filesystem. */
+static void* image_collect_aux(void* end_v, struct file* file) {
+	struct file*** end = end_v;
+
+	*(*end)++ = file;
+	return NULL;
+}
+
+/* Auxiliar function which counts the top-level files of a filesystem. */
+static void* image_collect_count_aux(void* count_v, struct file* file) {
+	(void)file; /* Supress unused parameter warning */
+	++*(int*)count_v;
+	return NULL;
+}
+
+/*
+ * Exports an image of a filesystem. Returns 0 if the file couldn't be written
+ * or a memory allocation failed, otherwise returns 1.
+ */
+int image_export(struct fs* fs, const char* filename) {
+	struct file** top, ** end;
+	int count = 0, ok;
+
+	file_traverse(filesystem_root(fs), &count, &image_collect_count_aux);
+	if ((top = malloc((count + 1) * sizeof(struct file*))) == NULL)
+		return 0; /* Allocation failed */
+
+	end = top;
+	file_traverse(filesystem_root(fs), &end, &image_collect_aux);
+	ok = image_export_files(filename, top, count);
+
+	free(top);
+	return ok;
+}
+
+/*
+ * Checks that a section of count items of size bytes each, at an offset, lies
+ * within an image of total bytes and is aligned for its fields. Returns 1 if it
+ * does, otherwise returns 0.
+ */
+static int image_check_section(unsigned int offset, unsigned long count,
+							   unsigned long size, unsigned long total) {
+	return offset % sizeof(unsigned int) == 0 && offset <= total &&
+		   count <= (total - offset) / size;
+}
+
+/*
+ * Checks every reference in a mapped image before it is used: each section
+ * must lie within the file, the strings section must end with a terminator,
+ * and every string offset and node index must be in range. Parents come before
+ * their nodes, sub-trees end after them and children are stored in node order
+ * (see image_build_nodes) beneath their own parent, so walking up a path, down
+ * the children or across a sub-tree always stops. Returns 1 if the image is
+ * valid, otherwise returns 0.
+ */
+static int image_validate(const struct image* image) {
+	const struct image_header* header = image->header;
+	const struct image_node* node;
+	unsigned long size = header->size, strings, entry_count;
+	unsigned int i, j, child, next = 0, count = header->node_count;
+
+	/* Sections, the entries run up to the strings, which run to the end */
+	if (count == 0 || header->bucket_count == 0 ||
+		(header->bucket_count & (header->bucket_count - 1)) != 0 ||
+		!image_check_section(header->nodes, count,
+							 sizeof(struct image_node), size) ||
+		!image_check_section(header->children, count,
+							 sizeof(unsigned int), size) ||
+		!image_check_section(header->buckets,
+							 (unsigned long)header->bucket_count + 1,
+							 sizeof(unsigned int), size) ||
+		!image_check_section(header->entries, 0, 1, size) ||
+		header->strings < header->entries || header->strings >= size)
+		return 0;
+	entry_count = (header->strings - header->entries) / sizeof(unsigned int);
+	strings = size - header->strings;
+	if (image->strings[strings - 1] != '\0')
+		return 0; /* The last string runs past the end */
+
+	for (i = 0; i < count; ++i) {
+		node = &image->nodes[i];
+		if (node->component >= strings ||
+			(node->value != IMAGE_NONE && node->value >= strings) ||
+			(i == 0 ? node->parent != IMAGE_NONE || node->end != count :
+			 node->parent >= i || node->end <= i || node->end > count))
+			return 0;
+	}
+
+	/* Every node but the root is the child of its parent exactly once */
+	for (i = 0; i < count; ++i) {
+		node = &image->nodes[i];
+		if (node->children != next || node->child_count > count - 1 - next)
+			return 0;
+		for (j = 0; j < node->child_count; ++j) {
+			child = image->children[next++];
+			if (child <= i || child >= node->end ||
+				image->nodes[child].parent != i)
+				return 0;
+		}
+	}
+	if (next != count - 1)
+		return 0;
+
+	/* Buckets are ranges of entries, and entries are nodes with values */
+	if (image->buckets[0] != 0 ||
+		image->buckets[header->bucket_count] != entry_count)
+		return 0;
+	for (i = 0; i < header->bucket_count; ++i)
+		if (image->buckets[i] > image->buckets[i + 1])
+			return 0;
+	for (i = 0; i < entry_count; ++i)
+		if (image->entries[i] >= count ||
+			image->nodes[image->entries[i]].value == IMAGE_NONE)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Maps an image file to memory. Returns NULL if the file couldn't be mapped or
+ * isn't a valid image.
+ */
+struct image* image_open(const char* filename) {
+	struct image* image;
+	struct stat st;
+	void* base;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 ||
+		st.st_size < (off_t)sizeof(struct image_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); /* The mapping stays valid */
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if ((image = malloc(sizeof(struct image))) == NULL) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	/* Sections are used in place, once every reference in them is checked */
+	image->base = base;
+	image->header = base;
+	if (memcmp(image->header->magic, IMAGE_MAGIC, 4) != 0 ||
+		image->header->version != IMAGE_VERSION ||
+		image->header->size != (unsigned long)st.st_size) {
+		munmap(base, st.st_size);
+		free(image);
+		return NULL;
+	}
+
+	image->nodes = (const void*)(image->base + image->header->nodes);
+	image->children = (const void*)(image->base + image->header->children);
+	image->buckets = (const void*)(image->base + image->header->buckets);
+	image->entries = (const void*)(image->base + image->header->entries);
+	image->strings = image->base + image->header->strings;
+	if (!image_validate(image)) {
+		image_close(image);
+		return NULL;
+	}
+	return image;
+}
+
+/* Unmaps an image and frees the memory associated with it. */
+void image_close(struct image* image) {
+	munmap((void*)image->base, image->header->size);
+	free(image);
+}
+
+/* Returns the number of files in an image, not counting the root. */
+int image_count(struct image* image) {
+	return image->header->node_count - 1;
+}
+
+/*
+ * Finds a child of a node by component, with a binary search on its sorted
+ * children. The component has length characters and needs no terminator.
+ * Returns IMAGE_NONE if there is no such child.
+ */
+static unsigned int image_find_child(struct image* image, unsigned int node,
+									 const char* comp, int length) {
+	const unsigned int* children =
+		image->children + image->nodes[node].children;
+	int low = 0, high = image->nodes[node].child_count - 1, mid, cmp;
+	const char* name;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		name = image->strings + image->nodes[children[mid]].component;
+		if ((cmp = strncmp(name, comp, length)) == 0 && name[length] != '\0')
+			cmp = 1; /* The name is longer than the component */
+
+		if (cmp < 0)
+			low = mid + 1;
+		else if (cmp > 0)
+			high = mid - 1;
+		else
+			return children[mid];
+	}
+
+	return IMAGE_NONE;
+}
+
+/*
+ * Finds a node from its path, without changing it. Returns -1 if no node was
+ * found.
+ */
+int image_find(struct image* image, const struct path* path) {
+	const struct component* comp = path->components;
+	const struct component* end = comp + path->count;
+	unsigned int node = 0;
+
+	for (; comp != end; ++comp)
+		if ((node = image_find_child(image, node, comp->start,
+									 comp->length)) == IMAGE_NONE)
+			return -1;
+
+	return node;
+}
+
+/* Returns a node's value, or NULL if it has none. */
+const char* image_value(struct image* image, int node) {
+	unsigned int value = image->nodes[node].value;
+	return value == IMAGE_NONE ? NULL : image->strings + value;
+}
+
+/* Returns a node's path component, which is empty for the root. */
+const char* image_component(struct image* image, int node) {
+	return image->strings + image->nodes[node].component;
+}
+
+/*
+ * Gets the sizes of a node's sub-tree, the same as file_usage. Images don't
+ * store them, but a sub-tree's nodes are contiguous, so its values are found
+ * without following any children.
+ */
+void image_usage(struct image* image, int node, struct usage* usage) {
+	const struct image_node* nodes = image->nodes;
+	unsigned int i;
+
+	usage->files = nodes[node].end - node - (node == 0);
+	usage->values = usage->bytes = 0;
+	for (i = node; i < nodes[node].end; ++i)
+		if (nodes[i].value != IMAGE_NONE) {
+			++usage->values;
+			usage->bytes += strlen(image->strings + nodes[i].value);
+		}
+}
+
+/*
+ * Returns the digest of a node's sub-tree, the same as file_digest returned
+ * for its file when the image was exported.
+ */
+unsigned long image_digest(struct image* image, int node) {
+	const unsigned int* digest = image->nodes[node].digest;
+	return (unsigned long)digest[1] << 32 | digest[0];
+}
+
+/*
+ * Returns the nodes immediately beneath a node, sorted lexicographically by
+ * component. *count is set to the number of nodes.
+ */
+const unsigned int* image_children(struct image* image, int node, int* count) {
+	*count = image->nodes[node].child_count;
+	return image->children + image->nodes[node].children;
+}
+
+/* Prints a node's path recursively. */
+void image_print_path(struct image* image, int node) {
+	if (image->nodes[node].parent == IMAGE_NONE)
+		return;
+	image_print_path(image, image->nodes[node].parent);
+	output_char('/');
+	output_str(image->strings + image->nodes[node].component);
+}
+
+/*
+ * Prints the path and value of a node and of every node beneath it, in the
+ * same order as file_print_tree, or every path and value except the root's if
+ * the node is the root, as file_print does.
+ */
+void image_print(struct image* image, int node) {
+	unsigned int i;
+
+	/* Nodes are stored in print order, a sub-tree's up to its end */
+	for (i = node == 0 ? 1 : node; i < image->nodes[node].end; ++i)
+		if (image->nodes[i].value != IMAGE_NONE) {
+			image_print_path(image, i);
+			output_char(' ');
+			output_puts(image->strings + image->nodes[i].value);
+		}
+}
+
+/* Prints the components immediately beneath a node lexicographically. */
+void image_list(struct image* image, int node) {
+	const unsigned int* children =
+		image->children + image->nodes[node].children;
+	unsigned int i;
+
+	for (i = 0; i < image->nodes[node].child_count; ++i)
+		output_puts(image->strings + image->nodes[children[i]].component);
+}
+
+/*
+ * Searches a node by value beneath a node, including the node itself, which
+ * is the root to search every node. Returns the first one in print order, or
+ * -1 if no node was found.
+ */
+int image_search(struct image* image, const char* value, int node) {
+	unsigned int h = image_hash(value) & (image->header->bucket_count - 1);
+	unsigned int i, end = image->nodes[node].end;
+
+	/*
+	 * Entries in a bucket are sorted by node, so the first match is the best.
+	 * Node numbers are DFS labels, so the nodes beneath a node are numbered
+	 * from it up to its end.
+	 */
+	for (i = image->buckets[h]; i < image->buckets[h + 1]; ++i)
+		if (image->entries[i] >= (unsigned int)node &&
+			image->entries[i] < end &&
+			strcmp(image->strings + image->nodes[image->entries[i]].value,
+				   value) == 0)
+			return image->entries[i];
+
+	return -1;
+}
+
+/*
+ * Prints the path of every node whose value starts with prefix, in print order.
+ * The image has no ordered value index, so every node is checked. Returns the
+ * number of paths printed.
+ */
+int image_search_prefix(struct image* image, const char* prefix) {
+	unsigned int i, length = strlen(prefix);
+	int count = 0;
+
+	for (i = 1; i < image->header->node_count; ++i)
+		if (image->nodes[i].value != IMAGE_NONE &&
+			strncmp(image->strings + image->nodes[i].value, prefix,
+					length) == 0) {
+			image_print_path(image, i);
+			output_char('\n');
+			++count;
+		}
+
+	return count;
+}
@@ -0,0 +1,380 @@
+/*
+ * File: 		index.c
+ * Author: 		Ricardo Antunes
+ * Description: Ordered value index used by the filesystem to search files by
+ * 				value prefix.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adt.h"
+
+/* Number of partitions of an index, one per character. */
+#define INDEX_PARTITIONS 256
+
+/*
+ * An index node. Each node holds every file which has a certain value, and
+ * the nodes are kept in an AVL tree sorted lexicographically by value.
+ */
+struct index_node {
+	char* value;				/* Value shared by every file in the node */
+	struct list* files;			/* Files with this value */
+	struct index_node* left;	/* Left (smaller) node, may be NULL */
+	struct index_node* right;	/* Right (bigger) node, may be NULL */
+	int height;					/* Height of the sub-tree rooted on this node */
+};
+
+/*
+ * Describes an ordered index of files by value. Values are partitioned by
+ * their first character, each in its own tree, which keeps them sorted across
+ * partitions. Each partition is changed with its lock held, so concurrent
+ * writers only wait for each other on values which start the same way, but
+ * prefix searches take no locks.
+ */
+struct index {
+	struct index_node* roots[INDEX_PARTITIONS];	/* Trees of each partition */
+	int locks[INDEX_PARTITIONS];				/* Locks of each partition */
+};
+
+/* Returns the height of a sub-tree of the index. */
+static int node_height(struct index_node* node) {
+	return node == NULL ? 0 : node->height;
+}
+
+/* Returns the balance factor of a sub-tree of the index. */
+static int node_balance_factor(struct index_node* node) {
+	if (node == NULL)
+		return 0;
+	return node_height(node->left) - node_height(node->right);
+}
+
+/* Update the height of a sub-tree of the index. */
+static void node_update_height(struct index_node* node) {
+	int h_left = node_height(node->left);
+	int h_right = node_height(node->right);
+	node->height = h_left > h_right ? h_left + 1 : h_right + 1;
+}
+
+/* Rotates left an index node. */
+static struct index_node* node_rotate_l(struct index_node* node) {
+	struct index_node* x = node->right;
+	node->right = x->left;
+	x->left = node;
+	node_update_height(node);
+	node_update_height(x);
+	return x;
+}
+
+/* Rotates right an index node. */
+static struct index_node* node_rotate_r(struct index_node* node) {
+	struct index_node* x = node->left;
+	node->left = x->right;
+	x->right = node;
+	node_update_height(node);
+	node_update_height(x);
+	return x;
+}
+
+/* Balances an index sub-tree and returns a pointer to the new root. */
+static struct index_node* node_balance(struct index_node* node) {
+	int balance_factor = node_balance_factor(node);
+
+	if (node == NULL)
+		return NULL;
+
+	if (balance_factor > 1) {
+		if (node_balance_factor(node->left) < 0)
+			node->left = node_rotate_l(node->left);
+		node = node_rotate_r(node);
+	}
+	else if (balance_factor < -1) {
+		if (node_balance_factor(node->right) > 0)
+			node->right = node_rotate_r(node->right);
+		node = node_rotate_l(node);
+	}
+	else
+		node_update_height(node);
+
+	return node;
+}
+
+/* Frees an index node and the list it owns. */
+static void node_free(struct index_node* node) {
+	list_destroy(node->files);
+	free(node->value);
+	free(node);
+}
+
+/*
+ * Allocates a new index node holding a single file, with its value. Returns
+ * NULL if the memory allocation failed.
+ */
+static struct index_node* node_alloc(struct file* file, const char* value) {
+	struct index_node* node;
+
+	if ((node = calloc(1, sizeof(struct index_node))) == NULL)
+		return NULL;
+	if ((node->value = malloc(strlen(value) + 1)) == NULL) {
+		free(node); /* Allocation failed */
+		return NULL;
+	}
+	if ((node->files = list_create()) == NULL ||
+		list_insert(node->files, file) == NULL) {
+		if (node->files != NULL)
+			list_destroy(node->files);
+		free(node->value); /* Allocation failed */
+		free(node);
+		return NULL;
+	}
+
+	strcpy(node->value, value);
+	node->height = 1;
+	return node;
+}
+
+/*
+ * Inserts a file with a value into an index sub-tree. If the memory allocation
+ * fails, the sub-tree is left unchanged and NULL is returned. Otherwise a
+ * pointer to the new sub-tree root is returned.
+ */
+static struct index_node* node_insert(struct index_node* node,
+									  struct file* file, const char* value) {
+	struct index_node* new;
+	int cmp;
+
+	if (node == NULL)
+		return node_alloc(file, value);
+
+	if (!(cmp = strcmp(value, node->value)))
+		return list_insert(node->files, file) == NULL ? NULL : node;
+
+	new = node_insert(cmp > 0 ? node->right : node->left, file, value);
+	if (new == NULL)
+		return NULL; /* Allocation failed */
+
+	cmp > 0 ? (node->right = new) : (node->left = new); /* Update sub-tree */
+	return node_balance(node);
+}
+
+/* Removes and returns the smallest node of an index sub-tree in *min. */
+static struct index_node* node_remove_min(struct index_node* node,
+										  struct index_node** min) {
+	if (node->left == NULL) {
+		*min = node;
+		return node->right;
+	}
+	node->left = node_remove_min(node->left, min);
+	return node_balance(node);
+}
+
+/*
+ * Frees a node, with its files, and returns the sub-tree which replaces it,
+ * rooted on its successor.
+ */
+static struct index_node* node_unlink(struct index_node* node) {
+	struct index_node* min;
+
+	if (node->left == NULL || node->right == NULL)
+		min = node->left == NULL ? node->right : node->left;
+	else {
+		node->right = node_remove_min(node->right, &min);
+		min->left = node->left;
+		min->right = node->right;
+	}
+	node_free(node);
+	return min;
+}
+
+/*
+ * Removes a file with a value from an index sub-tree, or every file with the
+ * value if file is NULL. The node is freed when its last file is removed. A
+ * pointer to the new sub-tree root is returned.
+ */
+static struct index_node* node_remove(struct index_node* node,
+									  struct file* file, const char* value) {
+	int cmp;
+
+	if (node == NULL)
+		return NULL;
+
+	cmp = strcmp(value, node->value); /* Binary search */
+	if (cmp < 0)
+		node->left = node_remove(node->left, file, value);
+	else if (cmp > 0)
+		node->right = node_remove(node->right, file, value);
+	else {
+		if (file != NULL) {
+			list_remove(node->files, list_find(node->files, file));
+			if (list_first(node->files) != NULL)
+				return node; /* Other files still have this value */
+		}
+		node = node_unlink(node); /* Replace the node by its successor */
+	}
+
+	return node_balance(node);
+}
+
+/* Frees all nodes in an index sub-tree. */
+static void node_destroy(struct index_node* node) {
+	if (node == NULL)
+		return;
+
+	node_destroy(node->left);
+	node_destroy(node->right);
+	node_free(node);
+}
+
+/*
+ * Traverses every node in a sub-tree whose value starts with prefix, in order.
+ * Sub-trees which can't contain the prefix are never visited.
+ */
+static void* node_traverse_prefix(struct index_node* node, const char* prefix,
+								  int length, void* ptr, traverse_fn fn) {
+	void* ret;
+	int cmp;
+
+	if (node == NULL)
+		return NULL;
+
+	cmp = strncmp(node->value, prefix, length);
+	if (cmp >= 0 && (ret = node_traverse_prefix(node->left, prefix, length,
+												 ptr, fn)) != NULL)
+		return ret;
+	if (cmp == 0 && (ret = list_traverse(node->files, ptr, fn)) != NULL)
+		return ret;
+	if (cmp <= 0)
+		return node_traverse_prefix(node->right, prefix, length, ptr, fn);
+	return NULL;
+}
+
+/*
+ * Creates a new value index and returns a pointer to it. Returns NULL if
+ * memory allocation fails.
+ */
+struct index* index_create(void) {
+	/* calloc initializes every root to NULL (0) and every lock to free */
+	return calloc(1, sizeof(struct index));
+}
+
+/* Frees all memory associated with a value index. */
+void index_destroy(struct index* index) {
+	int i;
+
+	for (i = 0; i < INDEX_PARTITIONS; ++i)
+		node_destroy(index->roots[i]);
+	free(index);
+}
+
+/*
+ * Inserts a file into a value index. Returns 0 if memory allocation fails,
+ * otherwise returns 1.
+ */
+int index_insert(struct index* index, struct file* file) {
+	/* The value is only unpacked once, if it is packed */
+	const char* value = file_value(file);
+	int i = (unsigned char)value[0];
+	struct index_node* root;
+
+	lock_acquire(&index->locks[i]);
+	if ((root = node_insert(index->roots[i], file, value)) != NULL)
+		index->roots[i] = root;
+	lock_release(&index->locks[i]);
+
+	return root != NULL;
+}
+
+/*
+ * Removes a file from a value index. If the file isn't in the index, nothing
+ * happens and the index is left unchanged.
+ */
+void index_remove(struct index* index, struct file* file) {
+	const char* value;
+	int i;
+
+	if (!file_has_value(file))
+		return;
+
+	value = file_value(file);
+	i = (unsigned char)value[0];
+	lock_acquire(&index->locks[i]);
+	index->roots[i] = node_remove(index->roots[i], file, value);
+	lock_release(&index->locks[i]);
+}
+
+/* Removes every file with a value from the index at once. */
+void index_remove_value(struct index* index, const char* value) {
+	int i = (unsigned char)value[0];
+
+	lock_acquire(&index->locks[i]);
+	index->roots[i] = node_remove(index->roots[i], NULL, value);
+	lock_release(&index->locks[i]);
+}
+
+/* Finds the node with a value in an index sub-tree, or NULL if none has it. */
+static struct index_node* node_find(struct index_node* node,
+									const char* value) {
+	int cmp;
+
+	while (node != NULL && (cmp = strcmp(value, node->value)) != 0)
+		node = cmp < 0 ? node->left : node->right;
+	return node;
+}
+
+/* Used to remove the deleted files in a node, see file_alive. */
+static void* index_deleted_aux(void* unused, struct file* file) {
+	(void)unused; /* Supress unused parameter warning */
+	return file_alive(file) ? NULL : file;
+}
+
+/*
+ * Removes an array of deleted files with values from the index. The node of
+ * each value is swept once if the files with the value are next to each other
+ * (see table_remove_deleted), and removed if no file is left in it. Nothing is
+ * allocated here, so the list of a node removed can't be reused by another one
+ * before the loop ends.
+ */
+void index_remove_deleted(struct index* index, struct file** files,
+						  int count) {
+	struct list* swept = NULL;
+	struct index_node* node;
+	const char* value;
+	int i, p;
+
+	for (i = 0; i < count; ++i) {
+		value = file_value(files[i]);
+		p = (unsigned char)value[0];
+		lock_acquire(&index->locks[p]);
+		node = node_find(index->roots[p], value);
+		if (node != NULL && node->files != swept) {
+			swept = node->files;
+			list_remove_if(node->files, NULL, &index_deleted_aux);
+			if (list_first(node->files) == NULL)
+				index->roots[p] = node_remove(index->roots[p], NULL, value);
+		}
+		lock_release(&index->locks[p]);
+	}
+}
+
+/*
+ * Traverses every file whose value starts with prefix, sorted by value.
+ * fn(ptr, file) is called for each file found. If fn(ptr, file) returns a
+ * non-NULL value, the traversal ends early and that value is returned.
+ * Otherwise, NULL is returned.
+ */
+void* index_traverse_prefix(struct index* index, const char* prefix, void* ptr,
+							traverse_fn fn) {
+	int i, length = strlen(prefix);
+	void* ret;
+
+	/* Only the partition of the first character can hold the prefix */
+	if (length > 0)
+		return node_traverse_prefix(index->roots[(unsigned char)prefix[0]],
+									prefix, length, ptr, fn);
+
+	for (i = 0; i < INDEX_PARTITIONS; ++i)
+		if ((ret = node_traverse_prefix(index->roots[i], prefix, 0, ptr,
+										fn)) != NULL)
+			return ret;
+	return NULL;
+}
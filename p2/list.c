@@ -1,116 +1,209 @@
 /*
  * File: 		list.c
  * Author: 		Ricardo Antunes
- * Description: Doubly linked list implementation used by the filesystem.
+ * Description: Unrolled linked list implementation used by the filesystem.
  */
 
+#include "constants.h"
 #include "adt.h"
 
 #include <stdlib.h>
 
-/* Describes a doubly linked list link. */
+/*
+ * Describes a slot in a list chunk. Links never move while the file is in the
+ * list, so a pointer to one can be used to remove the file in O(1).
+ */
 struct link {
-	struct file* file;		/* File this link points to */
-	struct link* prev;	/* Previous link, may be NULL */
-	struct link* next;	/* Next link, may be NULL */
+	struct file* file;		/* File this link points to, NULL if removed */
+	struct chunk* chunk;	/* Chunk where this link is stored */
 };
 
-/* Describes a doubly linked list. */
+/*
+ * Describes a list chunk, which packs many links contiguously so that they can
+ * be traversed without a cache miss per file.
+ */
+struct chunk {
+	struct chunk* prev;		/* Previous chunk, may be NULL */
+	struct chunk* next;		/* Next chunk, may be NULL */
+	int first;				/* Index of the first link which may be used */
+	int used;				/* Number of links ever used in this chunk */
+	int count;				/* Number of links still pointing to a file */
+	int size;				/* Number of links allocated in this chunk */
+	struct link links[1];	/* Links, allocated with the chunk */
+};
+
+/* Describes an unrolled linked list. */
 struct list {
-	struct link* first;
-	struct link* last;
+	struct chunk* first;
+	struct chunk* last;
 };
 
 /*
- * Creates a new doubly linked list and returns a pointer to it. If the
- * allocation fails, NULL is returned.  
+ * Allocates a new chunk with room for size links. If the allocation fails,
+ * NULL is returned.
+ */
+static struct chunk* chunk_alloc(int size) {
+	struct chunk* chunk;
+
+	chunk = malloc(sizeof(struct chunk) + (size - 1) * sizeof(struct link));
+	if (chunk != NULL) {
+		chunk->prev = chunk->next = NULL;
+		chunk->first = chunk->used = chunk->count = 0;
+		chunk->size = size;
+	}
+
+	return chunk;
+}
+
+/*
+ * Creates a new unrolled linked list and returns a pointer to it. If the
+ * allocation fails, NULL is returned.
  */
 struct list* list_create(void) {
 	/* calloc initializes list->first and list->last to NULL (0) */
 	return calloc(1, sizeof(struct list));
 }
 
-/* Destroys a doubly linked list, freeing all memory associated with it. */
+/* Destroys an unrolled linked list, freeing all memory associated with it. */
 void list_destroy(struct list* list) {
-	struct link* link;
-	
-	/* Free all links in the list */
+	struct chunk* chunk;
+
+	/* Free all chunks in the list */
 	while(list->first != NULL) {
-		link = list->first;
-		list->first = link->next;
-		free(link);
+		chunk = list->first;
+		list->first = chunk->next;
+		free(chunk);
 	}
 
 	free(list);
 }
 
 /*
- * Inserts a new file into a doubly linked list. If the allocation fails, NULL
- * is returned and the list remains unchanged. Otherwise, a pointer to the new
- * link which points to the file is returned.
+ * Inserts a new file into an unrolled linked list. If the allocation fails,
+ * NULL is returned and the list remains unchanged. Otherwise, a pointer to the
+ * new link which points to the file is returned.
  */
 struct link* list_insert(struct list* list, struct file* file) {
-	struct link* link = malloc(sizeof(struct link));
-	
-	/* Insert link at the end of the list */
-	if (link != NULL) {
-		link->next = NULL;
-		link->prev = list->last;
+	struct chunk* chunk = list->last;
+	struct link* link;
+	int size;
+
+	/*
+	 * Append a new chunk if the last one is full. Chunks grow geometrically so
+	 * that small lists stay small and wide ones are packed densely.
+	 */
+	if (chunk == NULL || chunk->used == chunk->size) {
+		size = chunk == NULL ? LIST_CHUNK_MIN_SIZE : chunk->size * 2;
+		if (size > LIST_CHUNK_MAX_SIZE)
+			size = LIST_CHUNK_MAX_SIZE;
+		if ((chunk = chunk_alloc(size)) == NULL)
+			return NULL; /* Allocation failed */
+
+		chunk->prev = list->last;
 		if (list->last != NULL)
-			list->last->next = link;
+			list->last->next = chunk;
 		if (list->first == NULL)
-			list->first = link;
-		list->last = link;
-		link->file = file;
+			list->first = chunk;
+		list->last = chunk;
 	}
 
+	/* Insert link at the end of the list */
+	link = &chunk->links[chunk->used++];
+	link->file = file;
+	link->chunk = chunk;
+	++chunk->count;
+
 	return link;
 }
 
-/* Removes a link from a list. If the link is NULL, nothing happens. */
+/*
+ * Removes a link from a list. If the link is NULL, nothing happens. The chunk
+ * where the link was stored is freed once all of its links are removed.
+ */
 void list_remove(struct list* list, struct link* link) {
+	struct chunk* chunk;
+
 	if (link == NULL)
 		return;
-	if (link->prev != NULL)
-		link->prev->next = link->next;
-	if (link->next != NULL)
-		link->next->prev = link->prev;
-	if (list->first == link)
-		list->first = link->next;
-	if (list->last == link)
-		list->last = link->prev;
-	free(link);
+
+	chunk = link->chunk;
+	link->file = NULL;
+	if (--chunk->count > 0)
+		return;
+
+	/* Chunk is empty, unlink it */
+	if (chunk->prev != NULL)
+		chunk->prev->next = chunk->next;
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk->prev;
+	if (list->first == chunk)
+		list->first = chunk->next;
+	if (list->last == chunk)
+		list->last = chunk->prev;
+	free(chunk);
 }
 
 /*
- * Traverses a doubly linked list. fn(ptr, file) is called for each file present
- * in the list. If fn(ptr, file) returns a non-NULL value, the traversal ends
- * early and that value is returned. Otherwise, NULL is returned.
+ * Removes every file in a list for which fn(ptr, file) returns a non-NULL
+ * value, in a single pass over the list.
+ */
+void list_remove_if(struct list* list, void* ptr, traverse_fn fn) {
+	struct chunk* chunk, * next;
+	int i, last;
+
+	for (chunk = list->first; chunk != NULL; chunk = next) {
+		next = chunk->next; /* The chunk is freed with its last link */
+		for (i = chunk->first, last = 0; !last && i < chunk->used; ++i)
+			if (chunk->links[i].file != NULL &&
+				fn(ptr, chunk->links[i].file) != NULL) {
+				last = chunk->count == 1;
+				list_remove(list, &chunk->links[i]);
+			}
+	}
+}
+
+/*
+ * Traverses an unrolled linked list. fn(ptr, file) is called for each file
+ * present in the list. If fn(ptr, file) returns a non-NULL value, the traversal
+ * ends early and that value is returned. Otherwise, NULL is returned.
  */
 void* list_traverse(struct list* list, void* ptr, traverse_fn fn) {
-	struct link* link;
+	struct chunk* chunk;
 	void* ret;
+	int i;
 
-	for (link = list->first; link != NULL; link = link->next)
-		if ((ret = fn(ptr, link->file)) != NULL)
-			return ret;
+	for (chunk = list->first; chunk != NULL; chunk = chunk->next)
+		for (i = chunk->first; i < chunk->used; ++i)
+			if (chunk->links[i].file != NULL &&
+				(ret = fn(ptr, chunk->links[i].file)) != NULL)
+				return ret;
 
 	return NULL;
 }
 
 /* Returns the link that points to a file. If no link is found, returns NULL. */
 struct link* list_find(struct list* list, struct file* file) {
-	struct link* link;
-	
+	struct chunk* chunk;
+	int i;
+
 	/* Iterate over the list to find the file */
-	for (link = list->first; link != NULL; link = link->next)
-		if (link->file == file)
-			return link;
+	for (chunk = list->first; chunk != NULL; chunk = chunk->next)
+		for (i = chunk->first; i < chunk->used; ++i)
+			if (chunk->links[i].file == file)
+				return &chunk->links[i];
 
 	return NULL;
 }
 
 /* Returns the first file in a list. */
 struct file* list_first(struct list* list) {
-	return list->first == NULL ? NULL : list->first->file;
+	struct chunk* chunk = list->first;
+
+	if (chunk == NULL)
+		return NULL;
+
+	/* Skip removed links, the first chunk always has at least one file */
+	while (chunk->links[chunk->first].file == NULL)
+		++chunk->first;
+	return chunk->links[chunk->first].file;
 }
@@ -0,0 +1,30 @@
+/*
+ * File: 		lock.c
+ * Author: 		Ricardo Antunes
+ * Description: Spinlocks taken by concurrent writers, small enough to keep one
+ * 				in every directory.
+ */
+
+#include <sched.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/*
+ * Acquires a lock, an int which is 0 when free. Locks are only held for a few
+ * instructions, so waiters spin, but they yield the processor every once in a
+ * while in case the holder isn't running.
+ */
+void lock_acquire(int* lock) {
+	int spin = 0;
+
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+			if (++spin % LOCK_SPIN_COUNT == 0)
+				sched_yield();
+}
+
+/* Releases a lock acquired by lock_acquire. */
+void lock_release(int* lock) {
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
@@ -4,28 +4,61 @@
  * Description: Main source file, where commands are read, parsed and executed.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "constants.h"
 #include "adt.h"
 
 /*
- * Removes beginning and trailing whitespaces from a string and returns it.
- * Since the returned address differs from the one passed to the function, the
- * resulting string must be freed using the original address.
+ * Characters read from stdin but not yet returned by read_line. stdin is read
+ * in blocks with read(2), so that the output is only handed to the writer
+ * thread when a read may block, instead of after every command.
+ */
+static char input_buffer[INPUT_BUFFER_SIZE];
+static int input_pos, input_end;
+
+/*
+ * Reads a line from stdin into line, like fgets: up to size - 1 characters are
+ * read, stopping after a newline, and a null character is added. Returns 0,
+ * leaving line unchanged, if stdin ended before any character was read.
+ * Otherwise returns 1.
  */
-static char* trim_whitespaces(char* str) {
-	int l;
+static int read_line(char* line, int size) {
+	const char* newline;
+	ssize_t count;
+	int n = 0, length;
 
-	str += strspn(str, WHITESPACE_CHARS); /* Skip beginning whitespaces */
-	l = strlen(str);
-	/* Remove trailing whitespaces */
-	for (; l > 0 && strchr(WHITESPACE_CHARS, str[l - 1]); --l)
-		str[l - 1] = '\0';
+	while (n < size - 1) {
+		if (input_pos == input_end) {
+			output_commit(); /* Nothing may be read for a while */
+			if ((count = read(STDIN_FILENO, input_buffer,
+							  INPUT_BUFFER_SIZE)) <= 0)
+				break; /* End of stdin, errors end it too */
+			input_pos = 0;
+			input_end = count;
+		}
 
-	return str;
+		length = input_end - input_pos;
+		length = length < size - 1 - n ? length : size - 1 - n;
+		newline = memchr(input_buffer + input_pos, '\n', length);
+		if (newline != NULL)
+			length = newline - (input_buffer + input_pos) + 1;
+		memcpy(line + n, input_buffer + input_pos, length);
+		input_pos += length;
+		n += length;
+		if (newline != NULL)
+			break;
+	}
+
+	if (n == 0)
+		return 0;
+	line[n] = '\0';
+	return 1;
 }
 
 /* Auxiliar function to parse_instruction, parses a quit instruction */
@@ -35,120 +68,871 @@ static int parse_quit_instruction() {
 
 /* Auxiliar function to parse_instruction, parses a help instruction */
 static int parse_help_instruction() {
-	puts(HELP_MESSAGE);
+	output_puts(HELP_MESSAGE);
+	output_puts(HELP_MESSAGE_EXTRA);
 	return SUCCESS_CODE;
 }
 
+/*
+ * Returns the filesystem where a path is stored. If the filesystem is sharded,
+ * this waits for the writes queued on the shard which owns the path.
+ */
+static struct fs* route_path(struct fs* fs, struct shards* shards,
+							 const struct path* path) {
+	return shards == NULL ? fs : shards_route(shards, path);
+}
+
 /* Auxiliar function to parse_instruction, parses a set instruction */
-static int parse_set_instruction(struct fs* fs) {
-	char* path = strtok(NULL, WHITESPACE_CHARS);
-	char* value = trim_whitespaces(strtok(NULL, ""));
+static int parse_set_instruction(struct instruction* instruction,
+								 struct fs* fs, struct shards* shards,
+								 struct writers* writers) {
+	const struct path* path = &instruction->path;
+	const char* value = instruction->value;
+	int length = instruction->value_length, time;
 
-	return file_set(fs, path, value) ? SUCCESS_CODE : NO_MEMORY_CODE;
+	if (repl_read_only()) {
+		output_puts(READ_ONLY_ERROR);
+		return SUCCESS_CODE;
+	}
+	if (shards != NULL)
+		return shards_set(shards, path, value, length) ? SUCCESS_CODE :
+														  NO_MEMORY_CODE;
+	if (writers != NULL)
+		return writers_set(writers, path, value, length) ? SUCCESS_CODE :
+															NO_MEMORY_CODE;
+
+	/* Followers create files with the same times as the leader */
+	time = filesystem_time(fs);
+	return file_set(fs, path, value, length) &&
+		   repl_set(path, value, length, time) ? SUCCESS_CODE : NO_MEMORY_CODE;
 }
 
-/* Auxiliar function to parse_instruction, parses a print instruction */
-static int parse_print_instruction(struct fs* fs) {
-	file_print(fs);
+/*
+ * Auxiliar function to parse_instruction, parses a print instruction. A path
+ * limits the print to the paths beneath it, including itself.
+ */
+static int parse_print_instruction(struct instruction* instruction,
+								   struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct file* file;
+
+	/* The root's children are spread across every shard */
+	if (shards != NULL && path->count == 0)
+		return shards_print(shards) ? SUCCESS_CODE : NO_MEMORY_CODE;
+
+	fs = route_path(fs, shards, path);
+	if (path->count == 0)
+		file_print(fs);
+	else if ((file = file_find(fs, path)) == NULL)
+		output_puts(NOT_FOUND_ERROR);
+	else
+		file_print_tree(fs, file);
 	return SUCCESS_CODE;
 }
 
 /* Auxiliar function to parse_instruction, parses a find instruction */
-static int parse_find_instruction(struct fs* fs) {
-	char* path = strtok(NULL, WHITESPACE_CHARS);
-	struct file* file = file_find(fs, path);
+static int parse_find_instruction(struct instruction* instruction,
+								  struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct file* file = file_find(route_path(fs, shards, path), path);
 
 	if (file == NULL)
-		puts(NOT_FOUND_ERROR);
+		output_puts(NOT_FOUND_ERROR);
 	else if (file_value(file) == NULL)
-		puts(NO_DATA_ERROR);
+		output_puts(NO_DATA_ERROR);
 	else
-		puts(file_value(file));
+		output_puts(file_value(file));
 	return SUCCESS_CODE;
 }
 
 /* Auxiliar function to parse_instruction, parses a list instruction */
-static int parse_list_instruction(struct fs* fs) {
-	char* path = strtok(NULL, WHITESPACE_CHARS);
-	struct file* file = file_find(fs, path);
+static int parse_list_instruction(struct instruction* instruction,
+								  struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct file* file;
 
-	if (file == NULL)
-		puts(NOT_FOUND_ERROR);
+	/* The root's children are spread across every shard */
+	if (shards != NULL && path->count == 0)
+		return shards_list(shards) ? SUCCESS_CODE : NO_MEMORY_CODE;
+
+	if ((file = file_find(route_path(fs, shards, path), path)) == NULL)
+		output_puts(NOT_FOUND_ERROR);
 	else
 		file_list(file);
 	return SUCCESS_CODE;
 }
 
-/* Auxiliar function to parse_instruction, parses a search instruction */
-static int parse_search_instruction(struct fs* fs) {
-	char* value = trim_whitespaces(strtok(NULL, ""));
-	struct file* file = file_search(fs, value);
-
+/* Prints the path of a file found by a search, or an error if it is NULL. */
+static void print_search_result(struct file* file) {
 	if (file == NULL)
-		puts(NOT_FOUND_ERROR);
+		output_puts(NOT_FOUND_ERROR);
 	else {
 		file_print_path(file);
-		putchar('\n');
+		output_char('\n');
+	}
+}
+
+/* Auxiliar function to parse_instruction, parses a search instruction */
+static int parse_search_instruction(struct instruction* instruction,
+									struct fs* fs, struct shards* shards) {
+	if (shards != NULL)
+		print_search_result(shards_search(shards, instruction->args));
+	else
+		print_search_result(file_search(fs, instruction->args));
+	return SUCCESS_CODE;
+}
+
+/*
+ * Auxiliar function to parse_instruction, parses a searchin instruction, which
+ * searches the paths beneath its path, including the path itself. The value
+ * is everything after the path, so it may have whitespace and slashes in it.
+ */
+static int parse_searchin_instruction(struct instruction* instruction,
+									  struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct file* file;
+
+	/* The root's children are spread across every shard */
+	if (shards != NULL && path->count == 0) {
+		print_search_result(shards_search(shards, instruction->value));
+		return SUCCESS_CODE;
+	}
+
+	fs = route_path(fs, shards, path);
+	if ((file = file_find(fs, path)) != NULL)
+		file = file_search_within(fs, instruction->value, file);
+	print_search_result(file);
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_instruction, parses a searchprefix instruction */
+static int parse_searchprefix_instruction(struct instruction* instruction,
+										  struct fs* fs,
+										  struct shards* shards) {
+	const char* prefix = instruction->args; /* May be empty */
+	struct file** files = NULL;
+	int i, count = 0, found;
+
+	/* An empty prefix matches every file with a value */
+	if (shards != NULL)
+		found = shards_search_prefix(shards, prefix, &files, &count);
+	else
+		found = file_search_prefix(fs, prefix, &files, &count);
+
+	/* Print matches following the order shown in the print command */
+	if (!found || !file_sort(files, count)) {
+		free(files);
+		return NO_MEMORY_CODE;
 	}
+	for (i = 0; i < count; ++i) {
+		file_print_path(files[i]);
+		output_char('\n');
+	}
+	if (count == 0)
+		output_puts(NOT_FOUND_ERROR);
+
+	free(files);
 	return SUCCESS_CODE;
 }
 
-/* Auxiliar function to parse_instruction, parses a delete instruction */
-static int parse_delete_instruction(struct fs* fs) {
-	char* path = strtok(NULL, WHITESPACE_CHARS);
+/*
+ * Auxiliar function to parse_instruction, parses a delete instruction. A path
+ * without components (or no path at all) deletes every path except the root.
+ */
+static int parse_delete_instruction(struct instruction* instruction,
+									struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
 	struct file* file;
 	
-	if (path == NULL)
-		file_delete(fs, NULL); /* Delete every path except root */
+	if (repl_read_only())
+		output_puts(READ_ONLY_ERROR);
+	else if (shards != NULL) {
+		if (!shards_delete(shards, path))
+			output_puts(NOT_FOUND_ERROR);
+	}
 	else if ((file = file_find(fs, path)) == NULL)
-		puts(NOT_FOUND_ERROR); 
-	else
+		output_puts(NOT_FOUND_ERROR); 
+	else {
 		file_delete(fs, file);
+		if (!repl_delete(path, filesystem_time(fs)))
+			return NO_MEMORY_CODE;
+	}
+	return SUCCESS_CODE;
+}
+
+/* Prints a named counter on its own line. */
+static void print_stat(const char* name, int value) {
+	output_str(name);
+	output_char(' ');
+	output_int(value);
+	output_char('\n');
+}
+
+/*
+ * Auxiliar function to parse_instruction, parses a deletevalue instruction.
+ * Every shard may hold paths with the value.
+ */
+static int parse_deletevalue_instruction(struct instruction* instruction,
+										 struct fs* fs,
+										 struct shards* shards) {
+	int deleted;
+
+	if (repl_read_only()) {
+		output_puts(READ_ONLY_ERROR);
+		return SUCCESS_CODE;
+	}
+
+	if (shards != NULL)
+		deleted = shards_delete_value(shards, instruction->args);
+	else
+		deleted = file_delete_value(fs, instruction->args);
+	if (deleted < 0)
+		return NO_MEMORY_CODE;
+
+	if (deleted == 0)
+		output_puts(NOT_FOUND_ERROR);
+	else if (shards == NULL && /* Sharded filesystems aren't replicated */
+			 !repl_delete_value(instruction->args, filesystem_time(fs)))
+		return NO_MEMORY_CODE;
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_instruction, parses a stats instruction */
+static int parse_stats_instruction(struct fs* fs, struct shards* shards) {
+	int i = 0, files = 0, pending = 0, reclaimed = 0;
+	int packing = 0, packed = 0, saved = 0;
+
+	/* Sum the counters of every shard, or use the only filesystem */
+	if (shards != NULL)
+		fs = shards_fs(shards, i);
+	while (fs != NULL) {
+		files += filesystem_files(fs);
+		pending += filesystem_pending(fs);
+		reclaimed += filesystem_reclaimed(fs);
+		packing = filesystem_packing(fs);
+		packed += filesystem_packed(fs);
+		saved += filesystem_saved(fs);
+		fs = shards != NULL ? shards_fs(shards, ++i) : NULL;
+	}
+
+	print_stat(STATS_FILES, files);
+	print_stat(STATS_PENDING, pending);
+	print_stat(STATS_RECLAIMED, reclaimed);
+
+	/* Packing counters, only shown when packing */
+	if (packing) {
+		print_stat(STATS_PACKED, packed);
+		print_stat(STATS_SAVED, saved);
+	}
+
+	/* Replication counters, only shown when replicating */
+	if (repl_leading() || repl_following()) {
+		print_stat(repl_leading() ? STATS_LOGGED : STATS_APPLIED,
+				   repl_count());
+		if (repl_lag() < 0)
+			output_puts(STATS_DISCONNECTED);
+		else
+			print_stat(STATS_LAG, repl_lag());
+	}
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_instruction, parses an export instruction */
+static int parse_export_instruction(struct instruction* instruction,
+									struct fs* fs, struct shards* shards) {
+	const char* filename = instruction->args;
+	int ok;
+
+	if (*filename == '\0')
+		ok = 0;
+	else if (shards != NULL)
+		ok = shards_export(shards, filename);
+	else
+		ok = image_export(fs, filename);
+
+	if (!ok)
+		output_puts(EXPORT_ERROR);
+	return SUCCESS_CODE;
+}
+
+/* Prints a digest in hexadecimal, on its own line. */
+static void print_digest(unsigned long digest) {
+	char digits[24];
+
+	sprintf(digits, "%016lx", digest);
+	output_puts(digits);
+}
+
+/* Auxiliar function to parse_instruction, parses a hash instruction */
+static int parse_hash_instruction(struct instruction* instruction,
+								  struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct file** files, * file;
+	int count;
+
+	/* The root's children are spread across every shard */
+	if (shards != NULL && path->count == 0) {
+		if ((files = shards_files(shards, &count)) == NULL)
+			return NO_MEMORY_CODE;
+		print_digest(file_digest_files(files, count));
+		free(files);
+	}
+	else if ((file = file_find(route_path(fs, shards, path), path)) == NULL)
+		output_puts(NOT_FOUND_ERROR);
+	else
+		print_digest(file_digest(file));
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_instruction, parses a diff instruction */
+static int parse_diff_instruction(struct instruction* instruction,
+								  struct fs* fs, struct shards* shards) {
+	struct image* image;
+	struct file** files;
+	int count, ok;
+
+	if ((image = image_open(instruction->args)) == NULL) {
+		output_puts(IMAGE_ERROR);
+		return SUCCESS_CODE;
+	}
+
+	if (shards != NULL)
+		files = shards_files(shards, &count);
+	else
+		files = file_children(filesystem_root(fs), &count);
+	ok = files != NULL && diff_files(files, count, image);
+
+	free(files);
+	image_close(image);
+	return ok ? SUCCESS_CODE : NO_MEMORY_CODE;
+}
+
+/* Prints the sizes of a sub-tree on a line, see DU_COMMAND. */
+static void print_usage(const struct usage* usage) {
+	output_int(usage->files);
+	output_char(' ');
+	output_int(usage->values);
+	output_char(' ');
+	output_int(usage->bytes);
+	output_char('\n');
+}
+
+/* Auxiliar function to parse_instruction, parses a du instruction */
+static int parse_du_instruction(struct instruction* instruction,
+								struct fs* fs, struct shards* shards) {
+	const struct path* path = &instruction->path;
+	struct usage usage, total = { 0, 0, 0 };
+	struct file* file;
+	int i;
+
+	/* The root's children are spread across every shard */
+	if (shards != NULL && path->count == 0) {
+		for (i = 0; (fs = shards_fs(shards, i)) != NULL; ++i) {
+			file_usage(filesystem_root(fs), &usage);
+			total.files += usage.files;
+			total.values += usage.values;
+			total.bytes += usage.bytes;
+		}
+		print_usage(&total);
+	}
+	else if ((file = file_find(route_path(fs, shards, path), path)) == NULL)
+		output_puts(NOT_FOUND_ERROR);
+	else {
+		file_usage(file, &usage);
+		print_usage(&usage);
+	}
 	return SUCCESS_CODE;
 }
 
-/* Parses and executes an instruction. */
-static int parse_instruction(char* instruction, struct fs* fs) {
-	char* command = strtok(instruction, WHITESPACE_CHARS); /* Get command */
+/* Auxiliar function to parse_instruction, parses a compact instruction */
+static int parse_compact_instruction(struct fs* fs, struct shards* shards) {
+	int i;
+
+	if (shards == NULL)
+		return filesystem_compact(fs) ? SUCCESS_CODE : NO_MEMORY_CODE;
+	for (i = 0; (fs = shards_fs(shards, i)) != NULL; ++i)
+		if (!filesystem_compact(fs))
+			return NO_MEMORY_CODE;
+	return SUCCESS_CODE;
+}
 
+/*
+ * Executes a scanned instruction. If shards isn't NULL, the instruction is
+ * executed on the sharded filesystem instead of fs. If writers isn't NULL, set
+ * instructions are queued on them, and must be waited for before any other
+ * instruction.
+ */
+static int parse_instruction(struct instruction* instruction, struct fs* fs,
+							 struct shards* shards, struct writers* writers) {
 	/* Execute function which corresponds to the command read */
-	if (strcmp(command, QUIT_COMMAND) == 0)
+	switch (instruction->command_id) {
+	case QUIT_ID:
 		return parse_quit_instruction();
-	else if (strcmp(command, HELP_COMMAND) == 0)
+	case HELP_ID:
 		return parse_help_instruction();
-	else if (strcmp(command, SET_COMMAND) == 0)
-		return parse_set_instruction(fs);
-	else if (strcmp(command, PRINT_COMMAND) == 0)
-		return parse_print_instruction(fs);
-	else if (strcmp(command, FIND_COMMAND) == 0)
-		return parse_find_instruction(fs);
-	else if (strcmp(command, LIST_COMMAND) == 0)
-		return parse_list_instruction(fs);
-	else if (strcmp(command, SEARCH_COMMAND) == 0)
-		return parse_search_instruction(fs);
-	else if (strcmp(command, DELETE_COMMAND) == 0)
-		return parse_delete_instruction(fs);
+	case SET_ID:
+		return parse_set_instruction(instruction, fs, shards, writers);
+	case PRINT_ID:
+		return parse_print_instruction(instruction, fs, shards);
+	case FIND_ID:
+		return parse_find_instruction(instruction, fs, shards);
+	case LIST_ID:
+		return parse_list_instruction(instruction, fs, shards);
+	case SEARCH_ID:
+		return parse_search_instruction(instruction, fs, shards);
+	case SEARCHPREFIX_ID:
+		return parse_searchprefix_instruction(instruction, fs, shards);
+	case DELETE_ID:
+		return parse_delete_instruction(instruction, fs, shards);
+	case STATS_ID:
+		return parse_stats_instruction(fs, shards);
+	case EXPORT_ID:
+		return parse_export_instruction(instruction, fs, shards);
+	case HASH_ID:
+		return parse_hash_instruction(instruction, fs, shards);
+	case DIFF_ID:
+		return parse_diff_instruction(instruction, fs, shards);
+	case DU_ID:
+		return parse_du_instruction(instruction, fs, shards);
+	case COMPACT_ID:
+		return parse_compact_instruction(fs, shards);
+	case DELETEVALUE_ID:
+		return parse_deletevalue_instruction(instruction, fs, shards);
+	case SEARCHIN_ID:
+		return parse_searchin_instruction(instruction, fs, shards);
+	default:
+		return QUIT_CODE; /* Unknown function, unreachable in test conditions */
+	}
+}
+
+/* Auxiliar function to parse_query_instruction, parses a find instruction */
+static int parse_query_find_instruction(struct instruction* instruction,
+										struct image* image) {
+	int node = image_find(image, &instruction->path);
+
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
+	else if (image_value(image, node) == NULL)
+		output_puts(NO_DATA_ERROR);
+	else
+		output_puts(image_value(image, node));
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_query_instruction, parses a list instruction */
+static int parse_query_list_instruction(struct instruction* instruction,
+										struct image* image) {
+	int node = image_find(image, &instruction->path);
+
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
+	else
+		image_list(image, node);
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_query_instruction, parses a print instruction */
+static int parse_query_print_instruction(struct instruction* instruction,
+										 struct image* image) {
+	int node = image_find(image, &instruction->path);
+
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
+	else
+		image_print(image, node);
+	return SUCCESS_CODE;
+}
+
+/* Prints the path of a node found by a search, or an error if it is -1. */
+static void print_query_search_result(struct image* image, int node) {
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
+	else {
+		image_print_path(image, node);
+		output_char('\n');
+	}
+}
+
+/* Auxiliar function to parse_query_instruction, parses a search instruction */
+static int parse_query_search_instruction(struct instruction* instruction,
+										  struct image* image) {
+	print_query_search_result(image,
+							  image_search(image, instruction->args, 0));
+	return SUCCESS_CODE;
+}
+
+/*
+ * Auxiliar function to parse_query_instruction, parses a searchin instruction,
+ * see parse_searchin_instruction.
+ */
+static int parse_query_searchin_instruction(struct instruction* instruction,
+											struct image* image) {
+	int node = image_find(image, &instruction->path);
+
+	if (node >= 0)
+		node = image_search(image, instruction->value, node);
+	print_query_search_result(image, node);
+	return SUCCESS_CODE;
+}
+
+/*
+ * Auxiliar function to parse_query_instruction, parses a searchprefix
+ * instruction.
+ */
+static int parse_query_searchprefix_instruction(struct instruction* instruction,
+												struct image* image) {
+	if (image_search_prefix(image, instruction->args) == 0)
+		output_puts(NOT_FOUND_ERROR);
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_query_instruction, parses a hash instruction */
+static int parse_query_hash_instruction(struct instruction* instruction,
+										struct image* image) {
+	int node = image_find(image, &instruction->path);
+
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
 	else
+		print_digest(image_digest(image, node));
+	return SUCCESS_CODE;
+}
+
+/* Auxiliar function to parse_query_instruction, parses a diff instruction */
+static int parse_query_diff_instruction(struct instruction* instruction,
+										struct image* image) {
+	struct image* other;
+	int ok;
+
+	if ((other = image_open(instruction->args)) == NULL) {
+		output_puts(IMAGE_ERROR);
+		return SUCCESS_CODE;
+	}
+
+	ok = diff_images(image, other);
+	image_close(other);
+	return ok ? SUCCESS_CODE : NO_MEMORY_CODE;
+}
+
+/* Auxiliar function to parse_query_instruction, parses a du instruction */
+static int parse_query_du_instruction(struct instruction* instruction,
+									  struct image* image) {
+	int node = image_find(image, &instruction->path);
+	struct usage usage;
+
+	if (node < 0)
+		output_puts(NOT_FOUND_ERROR);
+	else {
+		image_usage(image, node, &usage);
+		print_usage(&usage);
+	}
+	return SUCCESS_CODE;
+}
+
+/*
+ * Executes a scanned instruction on a read-only image. Instructions which
+ * would change the filesystem aren't executed.
+ */
+static int parse_query_instruction(struct instruction* instruction,
+								   struct image* image) {
+	/* Execute function which corresponds to the command read */
+	switch (instruction->command_id) {
+	case QUIT_ID:
+		return parse_quit_instruction();
+	case HELP_ID:
+		return parse_help_instruction();
+	case PRINT_ID:
+		return parse_query_print_instruction(instruction, image);
+	case FIND_ID:
+		return parse_query_find_instruction(instruction, image);
+	case LIST_ID:
+		return parse_query_list_instruction(instruction, image);
+	case SEARCH_ID:
+		return parse_query_search_instruction(instruction, image);
+	case SEARCHIN_ID:
+		return parse_query_searchin_instruction(instruction, image);
+	case SEARCHPREFIX_ID:
+		return parse_query_searchprefix_instruction(instruction, image);
+	case STATS_ID:
+		print_stat(STATS_FILES, image_count(image));
+		return SUCCESS_CODE;
+	case HASH_ID:
+		return parse_query_hash_instruction(instruction, image);
+	case DIFF_ID:
+		return parse_query_diff_instruction(instruction, image);
+	case DU_ID:
+		return parse_query_du_instruction(instruction, image);
+	case SET_ID:
+	case DELETE_ID:
+	case DELETEVALUE_ID:
+	case EXPORT_ID:
+	case COMPACT_ID:
+		output_puts(READ_ONLY_ERROR);
+		return SUCCESS_CODE;
+	default:
 		return QUIT_CODE; /* Unknown function, unreachable in test conditions */
+	}
 }
 
-/* Reads instructions from stdin line by line and executes them. */
-int main() {
+/* Reads instructions from stdin line by line and answers them from an image. */
+static int run_query(struct image* image) {
+	char line[MAX_INSTRUCTION_SIZE];
+	struct instruction instruction = { 0 };
 	int code;
-	char instruction[MAX_INSTRUCTION_SIZE];
-	struct fs* fs = filesystem_create(); /* Initialize filesystem */
 
-	/* Parse instructions */
 	do {
-		fgets(instruction, MAX_INSTRUCTION_SIZE, stdin);
-		code = parse_instruction(instruction, fs);
+		read_line(line, MAX_INSTRUCTION_SIZE);
+		if (!scan_instruction(&instruction, line)) {
+			code = NO_MEMORY_CODE;
+			break;
+		}
+		trace_begin(&instruction);
+
+		code = parse_query_instruction(&instruction, image);
+
+		trace_end(0);
+		trace_poll();
+	} while (code == SUCCESS_CODE);
+
+	scan_release(&instruction.path);
+	return code;
+}
+
+/* Reads instructions from stdin line by line and executes them. */
+static int run(struct fs* fs, struct shards* shards, struct writers* writers) {
+	char line[MAX_INSTRUCTION_SIZE];
+	struct instruction instruction = { 0 };
+	int code, touched;
+
+	do {
+		read_line(line, MAX_INSTRUCTION_SIZE);
+		if (!scan_instruction(&instruction, line)) {
+			code = NO_MEMORY_CODE;
+			break;
+		}
+		trace_begin(&instruction);
+		repl_lock(); /* Keep the replication thread off the filesystem */
+		touched = fs != NULL ? filesystem_touched(fs) : 0;
+
+		/* Everything but sets reads or deletes, so the writers must be done */
+		if (writers != NULL && instruction.command_id != SET_ID)
+			writers_wait(writers);
+		code = parse_instruction(&instruction, fs, shards, writers);
+		repl_commit(); /* Same for the replication thread */
+
+		/* Free some of the files deleted so far */
+		if (shards != NULL)
+			shards_reclaim(shards);
+		else
+			filesystem_reclaim(fs, RECLAIM_BATCH_SIZE);
+		repl_unlock();
+
+		/* Shards touch files on their own threads, so only fs is counted */
+		trace_end(fs != NULL ? filesystem_touched(fs) - touched : 0);
+		trace_poll();
 	} while(code == SUCCESS_CODE);
 
+	scan_release(&instruction.path);
+	return code;
+}
+
+/* Command line options. */
+struct options {
+	int shard_count;			/* Number of shards, 0 if not sharded */
+	int output_size;			/* Size of each output buffer */
+	const char* image_file;		/* Image to query, may be NULL */
+	const char* trace_file;		/* File the trace is dumped to, or NULL */
+	const char* decode_file;	/* Trace file to decode, may be NULL */
+	const char* lead_socket;	/* Socket to lead on, may be NULL */
+	const char* follow_socket;	/* Socket to follow, may be NULL */
+	int pack_length;			/* Shortest value packed, 0 if not packing */
+	int writer_count;			/* Number of writers, 0 if sets run inline */
+};
+
+/*
+ * Parses the command line options. Returns 0 if the options are invalid,
+ * otherwise returns 1.
+ */
+static int parse_options(int argc, char* argv[], struct options* options) {
+	int i;
+
+	options->shard_count = 0;
+	options->output_size = OUTPUT_BUFFER_SIZE;
+	options->image_file = NULL;
+	options->trace_file = NULL;
+	options->decode_file = NULL;
+	options->lead_socket = NULL;
+	options->follow_socket = NULL;
+	options->pack_length = 0;
+	options->writer_count = 0;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], SHARDS_OPTION) == 0) {
+			options->shard_count = atoi(argv[i + 1]);
+			if (options->shard_count < 1 ||
+				options->shard_count > MAX_SHARD_COUNT)
+				return 0;
+		}
+		else if (strcmp(argv[i], OUTPUT_OPTION) == 0) {
+			if ((options->output_size = atoi(argv[i + 1])) < 1)
+				return 0;
+		}
+		else if (strcmp(argv[i], QUERY_OPTION) == 0)
+			options->image_file = argv[i + 1];
+		else if (strcmp(argv[i], TRACE_OPTION) == 0)
+			options->trace_file = argv[i + 1];
+		else if (strcmp(argv[i], DECODE_OPTION) == 0)
+			options->decode_file = argv[i + 1];
+		else if (strcmp(argv[i], LEADER_OPTION) == 0)
+			options->lead_socket = argv[i + 1];
+		else if (strcmp(argv[i], FOLLOWER_OPTION) == 0)
+			options->follow_socket = argv[i + 1];
+		else if (strcmp(argv[i], PACK_OPTION) == 0) {
+			if ((options->pack_length = atoi(argv[i + 1])) < 1)
+				return 0;
+		}
+		else if (strcmp(argv[i], WRITERS_OPTION) == 0) {
+			options->writer_count = atoi(argv[i + 1]);
+			if (options->writer_count < 1 ||
+				options->writer_count > MAX_WRITER_COUNT)
+				return 0;
+		}
+		else
+			return 0;
+	}
+
+	/* Only a single unsharded filesystem can be replicated */
+	if ((options->lead_socket != NULL || options->follow_socket != NULL) &&
+		(options->shard_count > 0 || options->image_file != NULL ||
+		 (options->lead_socket != NULL && options->follow_socket != NULL)))
+		return 0;
+
+	/* Writers share a single unsharded and unreplicated filesystem */
+	if (options->writer_count > 0 &&
+		(options->shard_count > 0 || options->image_file != NULL ||
+		 options->lead_socket != NULL || options->follow_socket != NULL))
+		return 0;
+
+	return i == argc; /* Every option must have an argument */
+}
+
+/*
+ * Executes the instructions read from stdin on a filesystem, split in shards
+ * or written by concurrent writers if requested, or on an image. Returns 0 if
+ * the filesystem couldn't be created, otherwise returns 1.
+ */
+static int execute(struct options* options, struct image* image) {
+	struct fs* fs = NULL;
+	struct shards* shards = NULL;
+	struct writers* writers = NULL;
+	int i;
+
+	/* Images are read-only, so no filesystem is needed */
+	if (image != NULL) {
+		if (run_query(image) == NO_MEMORY_CODE)
+			output_puts(NO_MEMORY_ERROR);
+		return 1;
+	}
+
+	/* Initialize filesystem, split in shards if requested */
+	if (options->shard_count > 0)
+		shards = shards_create(options->shard_count);
+	else
+		fs = filesystem_create();
+	if (fs == NULL && shards == NULL)
+		return 0;
+
+	/* Pack long values on every filesystem, if requested */
+	if (options->pack_length > 0) {
+		for (i = 0; shards != NULL && shards_fs(shards, i) != NULL; ++i)
+			filesystem_set_packing(shards_fs(shards, i), options->pack_length);
+		if (fs != NULL)
+			filesystem_set_packing(fs, options->pack_length);
+	}
+
+	/* Start replicating, if requested */
+	if ((options->lead_socket != NULL &&
+		 !repl_lead(fs, options->lead_socket)) ||
+		(options->follow_socket != NULL &&
+		 !repl_follow(fs, options->follow_socket))) {
+		fputs(REPL_ERROR "\n", stderr);
+		filesystem_destroy(fs);
+		return 1;
+	}
+
+	/* Start the writers, which pack values too, so they come last */
+	if (options->writer_count > 0 &&
+		(writers = writers_create(fs, options->writer_count)) == NULL) {
+		filesystem_destroy(fs);
+		return 0;
+	}
+
 	/* Program run out of memory */
-	if (code == NO_MEMORY_CODE)
+	if (run(fs, shards, writers) == NO_MEMORY_CODE)
+		output_puts(NO_MEMORY_ERROR);
+	output_flush(); /* Everything is written before quitting */
+	repl_stop(); /* Followers get every change before the leader quits */
+
+	/* Cleanup */
+	if (writers != NULL)
+		writers_destroy(writers);
+	if (shards != NULL)
+		shards_destroy(shards);
+	else
+		filesystem_destroy(fs);
+	return 1;
+}
+
+/* Parses the command line options and executes what they request. */
+int main(int argc, char* argv[]) {
+	struct options options;
+	struct image* image = NULL;
+	int ok;
+
+	/* Only fails if two command names share a dispatch slot */
+	if (!scan_init())
+		return 1;
+
+	if (!parse_options(argc, argv, &options)) {
+		fputs(USAGE_ERROR "\n", stderr);
+		return 1;
+	}
+
+	/* Map the image to query, if one was requested */
+	if (options.image_file != NULL &&
+		(image = image_open(options.image_file)) == NULL) {
+		fputs(IMAGE_ERROR "\n", stderr);
+		return 1;
+	}
+
+	/* Start the thread which writes to stdout and the trace */
+	if (!output_create(options.output_size)) {
 		puts(NO_MEMORY_ERROR);
+		if (image != NULL)
+			image_close(image);
+		return 0;
+	}
+	if (!trace_create(options.trace_file)) {
+		output_puts(NO_MEMORY_ERROR);
+		output_destroy();
+		if (image != NULL)
+			image_close(image);
+		return 0;
+	}
+
+	if (options.decode_file != NULL) {
+		if (!(ok = trace_decode(options.decode_file)))
+			fputs(TRACE_ERROR "\n", stderr);
+	}
+	else if (!(ok = execute(&options, image)))
+		output_puts(NO_MEMORY_ERROR);
+	else if (options.trace_file != NULL)
+		trace_dump();
 
 	/* Cleanup */
-	filesystem_destroy(fs);
-	return 0;
-}
\ No newline at end of file
+	trace_destroy();
+	output_destroy();
+	if (image != NULL)
+		image_close(image);
+	return options.decode_file != NULL && !ok;
+}
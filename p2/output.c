@@ -0,0 +1,205 @@
+/*
+ * File: 		output.c
+ * Author: 		Ricardo Antunes
+ * Description: Buffered standard output, written by a dedicated thread so that
+ * 				slow readers don't stall the execution of commands.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adt.h"
+
+/*
+ * Describes the output subsystem. Commands append to the front buffer while the
+ * writer thread writes the back buffer to stdout. When the front buffer fills
+ * up the buffers are swapped, waiting for the writer if it is still busy, so
+ * at most two buffers worth of output are ever pending.
+ */
+struct output {
+	char* buffers[2];		/* Front and back buffers */
+	int front;				/* Index of the buffer commands append to */
+	int length;				/* Number of bytes in the front buffer */
+	int back_length;		/* Bytes in the back buffer, 0 if writer is idle */
+	int size;				/* Size of each buffer */
+	int quit;				/* Set when the writer must exit */
+
+	pthread_t thread;		/* Writer thread */
+	pthread_mutex_t mutex;	/* Protects back_length and quit */
+	pthread_cond_t wakeup;	/* Signaled when the back buffer has data or quit */
+	pthread_cond_t idle;	/* Signaled when the back buffer was written */
+};
+
+/* There is a single stdout, so the output state is kept here. */
+static struct output output;
+
+/* Writes a whole buffer to stdout, retrying on partial writes. */
+static void output_write_fd(const char* buffer, int length) {
+	ssize_t written;
+
+	while (length > 0) {
+		if ((written = write(STDOUT_FILENO, buffer, length)) < 0)
+			return; /* Nothing can be done if stdout fails */
+		buffer += written;
+		length -= written;
+	}
+}
+
+/* Writer thread entry point, writes back buffers until told to quit. */
+static void* output_run(void* unused) {
+	(void)unused; /* Supress unused parameter warning */
+
+	pthread_mutex_lock(&output.mutex);
+	for (;;) {
+		while (output.back_length == 0 && !output.quit)
+			pthread_cond_wait(&output.wakeup, &output.mutex);
+		if (output.back_length == 0)
+			break; /* Quit, with nothing left to write */
+
+		/* The back buffer belongs to this thread until back_length is 0 */
+		pthread_mutex_unlock(&output.mutex);
+		output_write_fd(output.buffers[!output.front], output.back_length);
+		pthread_mutex_lock(&output.mutex);
+
+		output.back_length = 0;
+		pthread_cond_signal(&output.idle);
+	}
+	pthread_mutex_unlock(&output.mutex);
+
+	return NULL;
+}
+
+/*
+ * Hands the front buffer to the writer thread. If the writer is still busy
+ * with the back buffer, waits until it finishes (back-pressure).
+ */
+static void output_swap(void) {
+	if (output.length == 0)
+		return;
+
+	pthread_mutex_lock(&output.mutex);
+	while (output.back_length != 0)
+		pthread_cond_wait(&output.idle, &output.mutex);
+	output.front = !output.front;
+	output.back_length = output.length;
+	output.length = 0;
+	pthread_cond_signal(&output.wakeup);
+	pthread_mutex_unlock(&output.mutex);
+}
+
+/*
+ * Starts the output subsystem, with two buffers of size bytes each. Returns 0
+ * if the memory allocation or the thread creation failed, otherwise returns 1.
+ */
+int output_create(int size) {
+	output.size = size;
+	output.buffers[0] = malloc(size);
+	output.buffers[1] = malloc(size);
+	if (output.buffers[0] == NULL || output.buffers[1] == NULL) {
+		free(output.buffers[0]); /* Allocation failed */
+		free(output.buffers[1]);
+		return 0;
+	}
+
+	pthread_mutex_init(&output.mutex, NULL);
+	pthread_cond_init(&output.wakeup, NULL);
+	pthread_cond_init(&output.idle, NULL);
+	if (pthread_create(&output.thread, NULL, &output_run, NULL) != 0) {
+		pthread_cond_destroy(&output.idle);
+		pthread_cond_destroy(&output.wakeup);
+		pthread_mutex_destroy(&output.mutex);
+		free(output.buffers[0]);
+		free(output.buffers[1]);
+		return 0; /* Thread creation failed */
+	}
+
+	return 1;
+}
+
+/* Writes everything still buffered and stops the output subsystem. */
+void output_destroy(void) {
+	output_flush();
+
+	pthread_mutex_lock(&output.mutex);
+	output.quit = 1;
+	pthread_cond_signal(&output.wakeup);
+	pthread_mutex_unlock(&output.mutex);
+
+	pthread_join(output.thread, NULL);
+	pthread_cond_destroy(&output.idle);
+	pthread_cond_destroy(&output.wakeup);
+	pthread_mutex_destroy(&output.mutex);
+	free(output.buffers[0]);
+	free(output.buffers[1]);
+}
+
+/* Waits until everything written so far has reached stdout. */
+void output_flush(void) {
+	output_swap();
+
+	pthread_mutex_lock(&output.mutex);
+	while (output.back_length != 0)
+		pthread_cond_wait(&output.idle, &output.mutex);
+	pthread_mutex_unlock(&output.mutex);
+}
+
+/*
+ * Hands the buffered output to the writer thread, waiting for it if it is
+ * still busy. Called before stdin may block, so that output isn't held back
+ * while waiting for input, but otherwise piles into large writes.
+ */
+void output_commit(void) {
+	output_swap();
+}
+
+/* Appends length bytes from str to the output. */
+void output_write(const char* str, int length) {
+	int n;
+
+	while (length > 0) {
+		if (output.length == output.size)
+			output_swap(); /* Front buffer is full */
+
+		n = output.size - output.length;
+		n = n < length ? n : length;
+		memcpy(output.buffers[output.front] + output.length, str, n);
+		output.length += n;
+		str += n;
+		length -= n;
+	}
+}
+
+/* Appends a string to the output. */
+void output_str(const char* str) {
+	output_write(str, strlen(str));
+}
+
+/* Appends a string followed by a newline to the output, like puts. */
+void output_puts(const char* str) {
+	output_str(str);
+	output_char('\n');
+}
+
+/* Appends a character to the output, like putchar. */
+void output_char(char c) {
+	output_write(&c, 1);
+}
+
+/* Appends an integer, in decimal, to the output. */
+void output_int(int value) {
+	char digits[16], * p = digits + sizeof(digits);
+	unsigned int u = value < 0 ? -(unsigned int)value : (unsigned int)value;
+
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (value < 0)
+		*--p = '-';
+
+	output_write(p, digits + sizeof(digits) - p);
+}
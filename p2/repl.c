@@ -0,0 +1,804 @@
+/*
+ * File: 		repl.c
+ * Author: 		Ricardo Antunes
+ * Description: Replication to a warm standby process. The leader ships a log
+ * 				of the changes made to its filesystem over a Unix socket, and
+ * 				the follower applies it while answering read commands.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/* Record types. */
+#define REPL_RESET 0	/* Delete every path, sent before a snapshot */
+#define REPL_SET 1		/* Set a path's value */
+#define REPL_CREATE 2	/* Create a path without a value */
+#define REPL_DELETE 3	/* Delete a path and every path beneath it */
+#define REPL_DELETE_VALUE 4	/* Delete the paths with a value, see below */
+
+/* Roles of a process. */
+#define REPL_NONE 0
+#define REPL_LEADER 1
+#define REPL_FOLLOWER 2
+
+/*
+ * States of the connection. A follower is streaming until the leader is gone,
+ * when it becomes idle and takes writes, or until the log can't be applied,
+ * when it fails and stays read only, since its filesystem may be incomplete.
+ */
+#define REPL_IDLE 0			/* Waiting for a follower, changes aren't logged */
+#define REPL_STREAMING 1	/* Changes are logged and shipped, or applied */
+#define REPL_FAILED 2		/* The follower stopped applying the log */
+
+/*
+ * A change to the filesystem, followed by path_length characters of its path
+ * and value_length characters of its value. Records are packed one after the
+ * other, so they are copied in and out with memcpy.
+ */
+struct repl_record {
+	unsigned int type;			/* One of the record types */
+	unsigned int time;			/* Time of the filesystem before the change */
+	unsigned int path_length;	/* Number of characters in the path */
+	unsigned int value_length;	/* Number of characters in the value */
+};
+
+/* Header sent before each batch of records. */
+struct repl_batch {
+	unsigned int length;	/* Number of bytes of records after the header */
+	unsigned int count;		/* Number of records */
+	unsigned int sec;		/* When the first record was logged, on the */
+	unsigned int nsec;		/* leader's monotonic clock */
+};
+
+/* A batch of records being logged or shipped. */
+struct repl_buffer {
+	char* data;				/* Records */
+	int length;				/* Number of bytes of records */
+	int capacity;			/* Number of bytes allocated */
+	unsigned int count;		/* Number of records */
+	struct timespec start;	/* When the first record was logged */
+};
+
+/*
+ * Describes replication, as a leader or as a follower. Like output.c, the
+ * leader logs changes to the front buffer while its thread ships the back
+ * buffer, so changes made while a batch is being shipped pile up into the
+ * next one. The follower's thread reads batches and applies them.
+ */
+struct repl {
+	int role;						/* One of the roles */
+	struct fs* fs;					/* Filesystem replicated */
+	int socket;						/* Listening socket, or the connection */
+	struct sockaddr_un address;		/* Address of the leader's socket */
+
+	struct repl_buffer buffers[2];	/* Front and back buffers, leader only */
+	int front;						/* Index of the buffer changes go to */
+	int shipping;					/* Set while the back buffer is shipped */
+	int state;						/* State of the connection */
+	int quit;						/* Set when the thread must exit */
+
+	unsigned long count;			/* Records logged or applied */
+	unsigned long lag;				/* Lag of the last batch applied, in ns */
+
+	pthread_t thread;				/* Ships or applies the log */
+	pthread_mutex_t fs_mutex;		/* Held while the filesystem is used, and
+									   while a follower's state changes */
+	pthread_mutex_t mutex;			/* Protects shipping, state and quit */
+	pthread_cond_t wakeup;			/* Signaled when there is a batch or quit */
+	pthread_cond_t idle;			/* Signaled when a batch was shipped */
+};
+
+/* A process has a single role, so the replication state is kept here. */
+static struct repl repl;
+
+/* Fields shared between threads, see shard.c. */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+
+/* Returns the nanoseconds elapsed since a time on the monotonic clock. */
+static unsigned long repl_elapsed(unsigned long sec, unsigned long nsec) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((unsigned long)now.tv_sec - sec) * 1000000000ul +
+		   (unsigned long)now.tv_nsec - nsec;
+}
+
+/*
+ * Makes room for size more bytes in a buffer. Returns 0 if the memory
+ * allocation failed, otherwise returns 1.
+ */
+static int repl_reserve(struct repl_buffer* buffer, int size) {
+	int capacity = buffer->capacity == 0 ? REPL_BUFFER_SIZE : buffer->capacity;
+	char* data;
+
+	if (buffer->length + size <= buffer->capacity)
+		return 1;
+	while (capacity < buffer->length + size)
+		capacity *= 2;
+	if ((data = realloc(buffer->data, capacity)) == NULL)
+		return 0; /* Allocation failed */
+
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return 1;
+}
+
+/*
+ * Appends a record to a buffer, with room for a path of path_length characters
+ * which the caller must write where the pointer returned points to. Returns
+ * NULL if the memory allocation failed.
+ */
+static char* repl_add(struct repl_buffer* buffer, unsigned int type,
+					  unsigned int time, int path_length, const char* value,
+					  int value_length) {
+	struct repl_record record;
+	char* p;
+
+	if (!repl_reserve(buffer, sizeof(record) + path_length + value_length))
+		return NULL; /* Allocation failed */
+	if (buffer->count++ == 0)
+		clock_gettime(CLOCK_MONOTONIC, &buffer->start);
+
+	record.type = type;
+	record.time = time;
+	record.path_length = path_length;
+	record.value_length = value_length;
+
+	p = buffer->data + buffer->length;
+	memcpy(p, &record, sizeof(record));
+	if (value_length > 0)
+		memcpy(p + sizeof(record) + path_length, value, value_length);
+	buffer->length += sizeof(record) + path_length + value_length;
+
+	return p + sizeof(record);
+}
+
+/* Writes the whole of a buffer to a socket. Returns 0 if it failed. */
+static int repl_write(int fd, const void* data, int length) {
+	const char* p = data;
+	ssize_t written;
+
+	while (length > 0) {
+		if ((written = send(fd, p, length, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += written;
+		length -= written;
+	}
+
+	return 1;
+}
+
+/* Reads exactly length bytes from a socket. Returns 0 if it failed. */
+static int repl_read(int fd, void* data, int length) {
+	char* p = data;
+	ssize_t got;
+
+	while (length > 0) {
+		if ((got = read(fd, p, length)) <= 0) {
+			if (got < 0 && errno == EINTR)
+				continue;
+			return 0; /* Error or end of the log */
+		}
+		p += got;
+		length -= got;
+	}
+
+	return 1;
+}
+
+/*
+ * Ships a batch to the follower and empties the buffer. Returns 0 if it
+ * couldn't be written, otherwise returns 1.
+ */
+static int repl_ship(int fd, struct repl_buffer* buffer) {
+	struct repl_batch batch;
+	int ok;
+
+	batch.length = buffer->length;
+	batch.count = buffer->count;
+	batch.sec = buffer->start.tv_sec;
+	batch.nsec = buffer->start.tv_nsec;
+
+	ok = repl_write(fd, &batch, sizeof(batch)) &&
+		 repl_write(fd, buffer->data, buffer->length);
+	buffer->length = 0;
+	buffer->count = 0;
+	return ok;
+}
+
+/* Data used while a snapshot is being shipped. */
+struct repl_snapshot {
+	int fd;					/* Follower's connection */
+	struct repl_buffer buffer;	/* Batch being built */
+	char* path;				/* Path of the current file */
+	int length;				/* Number of characters in path */
+	int capacity;			/* Number of characters allocated for path */
+};
+
+/*
+ * Auxiliar function which adds a record for each file beneath a file, in print
+ * order, shipping a batch whenever it fills up. Each record creates a single
+ * file, with the time it was created on the leader. Ends the traversal early if
+ * a memory allocation or a write failed.
+ */
+static void* repl_snapshot_aux(void* snapshot_v, struct file* file) {
+	struct repl_snapshot* snapshot = snapshot_v;
+	const char* component = file_component(file), * value = file_value(file);
+	int length = snapshot->length, n = strlen(component);
+	char* p;
+
+	/* Append the component to the path of the parent */
+	if (length + n + 1 > snapshot->capacity) {
+		snapshot->capacity = 2 * (length + n + 1);
+		if ((p = realloc(snapshot->path, snapshot->capacity)) == NULL)
+			return snapshot; /* Allocation failed */
+		snapshot->path = p;
+	}
+	snapshot->path[snapshot->length++] = '/';
+	memcpy(snapshot->path + snapshot->length, component, n);
+	snapshot->length += n;
+
+	if (snapshot->buffer.length >= REPL_BUFFER_SIZE &&
+		!repl_ship(snapshot->fd, &snapshot->buffer))
+		return snapshot; /* The follower is gone */
+
+	p = repl_add(&snapshot->buffer, value == NULL ? REPL_CREATE : REPL_SET,
+				 file_time(file) - 1, snapshot->length, value,
+				 value == NULL ? 0 : strlen(value));
+	if (p == NULL)
+		return snapshot; /* Allocation failed */
+	memcpy(p, snapshot->path, snapshot->length);
+
+	if (file_traverse(file, snapshot, &repl_snapshot_aux) != NULL)
+		return snapshot;
+	snapshot->length = length;
+	return NULL;
+}
+
+/*
+ * Ships a snapshot of the filesystem to a new follower, starting with a reset
+ * record. Changes are logged from then on, and the front buffer is emptied,
+ * since anything in it is older than the snapshot. Commands wait until the
+ * snapshot is shipped. Returns 0 if a memory allocation or a write failed,
+ * otherwise returns 1.
+ */
+static int repl_snapshot(int fd) {
+	struct repl_snapshot snapshot;
+	struct repl_buffer* front;
+	int ok;
+
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.fd = fd;
+
+	pthread_mutex_lock(&repl.fs_mutex);
+	pthread_mutex_lock(&repl.mutex);
+	front = &repl.buffers[repl.front];
+	front->length = 0;
+	front->count = 0;
+	STORE(repl.state, REPL_STREAMING);
+	pthread_mutex_unlock(&repl.mutex);
+
+	ok = repl_add(&snapshot.buffer, REPL_RESET, 0, 0, NULL, 0) != NULL &&
+		 file_traverse(filesystem_root(repl.fs), &snapshot,
+					   &repl_snapshot_aux) == NULL &&
+		 repl_ship(fd, &snapshot.buffer);
+	pthread_mutex_unlock(&repl.fs_mutex);
+
+	free(snapshot.buffer.data);
+	free(snapshot.path);
+	return ok;
+}
+
+/*
+ * Hands the front buffer to the leader thread. If wait is 1 and the back
+ * buffer is still being shipped, waits until it is (back-pressure). The front
+ * buffer is dropped if there is no follower. Must be called with the
+ * filesystem locked.
+ */
+static void repl_swap(int wait) {
+	struct repl_buffer* front = &repl.buffers[repl.front];
+
+	if (front->count == 0)
+		return;
+
+	pthread_mutex_lock(&repl.mutex);
+	while (wait && repl.shipping && LOAD(repl.state) == REPL_STREAMING)
+		pthread_cond_wait(&repl.idle, &repl.mutex);
+	if (LOAD(repl.state) != REPL_STREAMING) {
+		front->length = 0; /* Nobody to ship it to */
+		front->count = 0;
+	}
+	else if (!repl.shipping) {
+		repl.front = !repl.front;
+		repl.shipping = 1;
+		pthread_cond_signal(&repl.wakeup);
+	}
+	pthread_mutex_unlock(&repl.mutex);
+}
+
+/*
+ * Leader thread entry point. Waits for a follower, ships it a snapshot and
+ * then every batch logged, until the follower is gone or told to quit.
+ */
+static void* repl_lead_run(void* unused) {
+	struct repl_buffer* back;
+	int fd, ok;
+
+	(void)unused; /* Supress unused parameter warning */
+
+	while (!LOAD(repl.quit)) {
+		if ((fd = accept(repl.socket, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break; /* The socket is broken */
+		}
+
+		ok = !LOAD(repl.quit) && repl_snapshot(fd);
+
+		pthread_mutex_lock(&repl.mutex);
+		while (ok) {
+			while (!repl.shipping && !repl.quit)
+				pthread_cond_wait(&repl.wakeup, &repl.mutex);
+			if (!repl.shipping)
+				break; /* Quit, with nothing left to ship */
+
+			/* The back buffer belongs to this thread until shipping is 0 */
+			back = &repl.buffers[!repl.front];
+			pthread_mutex_unlock(&repl.mutex);
+			ok = repl_ship(fd, back);
+			pthread_mutex_lock(&repl.mutex);
+
+			repl.shipping = 0;
+			pthread_cond_signal(&repl.idle);
+
+			/*
+			 * Changes logged while shipping are shipped right away if no
+			 * command is running, otherwise repl_commit ships them.
+			 */
+			pthread_mutex_unlock(&repl.mutex);
+			if (pthread_mutex_trylock(&repl.fs_mutex) == 0) {
+				repl_swap(0);
+				pthread_mutex_unlock(&repl.fs_mutex);
+			}
+			pthread_mutex_lock(&repl.mutex);
+		}
+
+		/* Stop logging until the next follower arrives */
+		STORE(repl.state, REPL_IDLE);
+		pthread_cond_broadcast(&repl.idle);
+		pthread_mutex_unlock(&repl.mutex);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/*
+ * Applies a batch of length bytes of records to the filesystem, splitting
+ * paths into path. Returns 0 if the batch is malformed or a memory allocation
+ * failed, otherwise returns 1.
+ */
+static int repl_apply(const char* data, unsigned int length,
+					  struct path* path) {
+	struct repl_record record;
+	const char* end = data + length;
+	struct file* file;
+
+	while (data != end) {
+		if ((unsigned int)(end - data) < sizeof(record))
+			return 0; /* Truncated record */
+		memcpy(&record, data, sizeof(record));
+		data += sizeof(record);
+		if ((unsigned int)(end - data) < record.path_length ||
+			(unsigned int)(end - data) - record.path_length <
+			record.value_length)
+			return 0; /* Truncated record */
+
+		if (!scan_path(path, data, record.path_length))
+			return 0; /* Allocation failed */
+		data += record.path_length;
+		filesystem_set_time(repl.fs, record.time);
+
+		switch (record.type) {
+		case REPL_RESET:
+			file_delete(repl.fs, NULL);
+			break;
+		case REPL_SET:
+			if (file_set(repl.fs, path, data, record.value_length) == NULL)
+				return 0; /* Allocation failed */
+			break;
+		case REPL_CREATE:
+			if (file_create(repl.fs, path) == NULL)
+				return 0; /* Allocation failed */
+			break;
+		case REPL_DELETE:
+			if ((file = file_find(repl.fs, path)) != NULL)
+				file_delete(repl.fs, file);
+			break;
+		case REPL_DELETE_VALUE:
+			if (record.value_length == 0 ||
+				data[record.value_length - 1] != '\0')
+				return 0; /* Malformed record */
+			if (file_delete_value(repl.fs, data) < 0)
+				return 0; /* Allocation failed */
+			break;
+		default:
+			return 0; /* Unknown record */
+		}
+		data += record.value_length;
+	}
+
+	return 1;
+}
+
+/*
+ * Follower thread entry point. Reads batches from the leader and applies them,
+ * until the leader is gone or told to quit, when the follower takes writes
+ * (a batch cut short is dropped whole), or until a batch can't be applied, when
+ * the error is reported and the follower stays read only.
+ */
+static void* repl_follow_run(void* unused) {
+	struct repl_batch batch;
+	struct path path = { 0 };
+	char* data = NULL, * p;
+	unsigned int capacity = 0;
+	int state = REPL_IDLE;
+
+	(void)unused; /* Supress unused parameter warning */
+
+	/* Idle until a batch fails, which is what the follower becomes at EOF */
+	while (state == REPL_IDLE &&
+		   repl_read(repl.socket, &batch, sizeof(batch))) {
+		if (batch.length > capacity) {
+			if ((p = realloc(data, batch.length)) == NULL) {
+				state = REPL_FAILED; /* Allocation failed */
+				break;
+			}
+			data = p;
+			capacity = batch.length;
+		}
+		if (!repl_read(repl.socket, data, batch.length))
+			break;
+
+		pthread_mutex_lock(&repl.fs_mutex);
+		if (!repl_apply(data, batch.length, &path))
+			state = REPL_FAILED;
+		repl.count += batch.count;
+		repl.lag = repl_elapsed(batch.sec, batch.nsec);
+		filesystem_reclaim(repl.fs, RECLAIM_BATCH_SIZE);
+		pthread_mutex_unlock(&repl.fs_mutex);
+	}
+
+	pthread_mutex_lock(&repl.fs_mutex);
+	repl.state = state;
+	pthread_mutex_unlock(&repl.fs_mutex);
+	if (!LOAD(repl.quit))
+		fputs(state == REPL_FAILED ? REPL_APPLY_ERROR "\n" :
+									 REPL_LEADER_ERROR "\n", stderr);
+
+	free(data);
+	scan_release(&path);
+	return NULL;
+}
+
+/*
+ * Initializes the locks and starts the replication thread. Returns 0 if the
+ * thread couldn't be created, otherwise returns 1.
+ */
+static int repl_start(struct fs* fs, int role, void* (*run)(void*)) {
+	repl.fs = fs;
+	repl.role = role;
+	pthread_mutex_init(&repl.fs_mutex, NULL);
+	pthread_mutex_init(&repl.mutex, NULL);
+	pthread_cond_init(&repl.wakeup, NULL);
+	pthread_cond_init(&repl.idle, NULL);
+
+	if (pthread_create(&repl.thread, NULL, run, NULL) != 0) {
+		pthread_cond_destroy(&repl.idle);
+		pthread_cond_destroy(&repl.wakeup);
+		pthread_mutex_destroy(&repl.mutex);
+		pthread_mutex_destroy(&repl.fs_mutex);
+		close(repl.socket);
+		repl.role = REPL_NONE;
+		return 0; /* Thread creation failed */
+	}
+
+	return 1;
+}
+
+/*
+ * Sets the address of a Unix socket. Returns 0 if the path is too long,
+ * otherwise returns 1.
+ */
+static int repl_address(const char* path) {
+	if (strlen(path) >= sizeof(repl.address.sun_path))
+		return 0;
+	memset(&repl.address, 0, sizeof(repl.address));
+	repl.address.sun_family = AF_UNIX;
+	strcpy(repl.address.sun_path, path);
+	return 1;
+}
+
+/*
+ * Starts leading, listening for a follower on a Unix socket at path. Changes
+ * made to fs are only logged while a follower is connected, and each new
+ * follower is first sent a snapshot. Returns 0 if the socket or the thread
+ * couldn't be created, otherwise returns 1.
+ */
+int repl_lead(struct fs* fs, const char* path) {
+	struct stat st;
+
+	if (!repl_address(path))
+		return 0;
+
+	/* A socket left behind by a leader which didn't stop is replaced */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	if ((repl.socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 0;
+	if (bind(repl.socket, (struct sockaddr*)&repl.address,
+			 sizeof(repl.address)) != 0 || listen(repl.socket, 1) != 0) {
+		close(repl.socket);
+		return 0;
+	}
+
+	if (!repl_start(fs, REPL_LEADER, &repl_lead_run)) {
+		unlink(path);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Starts following the leader listening on a Unix socket at path, applying its
+ * log to fs, which must be empty. Returns 0 if the leader couldn't be reached
+ * or the thread couldn't be created, otherwise returns 1.
+ */
+int repl_follow(struct fs* fs, const char* path) {
+	if (!repl_address(path))
+		return 0;
+
+	if ((repl.socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 0;
+	if (connect(repl.socket, (struct sockaddr*)&repl.address,
+				sizeof(repl.address)) != 0) {
+		close(repl.socket);
+		return 0;
+	}
+
+	repl.state = REPL_STREAMING;
+	return repl_start(fs, REPL_FOLLOWER, &repl_follow_run);
+}
+
+/*
+ * Stops replicating. A leader ships everything logged so far to its follower
+ * first. Does nothing if this process isn't replicating.
+ */
+void repl_stop(void) {
+	int fd;
+
+	if (repl.role == REPL_NONE)
+		return;
+
+	if (repl.role == REPL_LEADER) {
+		pthread_mutex_lock(&repl.fs_mutex);
+		repl_swap(1);
+		pthread_mutex_unlock(&repl.fs_mutex);
+
+		pthread_mutex_lock(&repl.mutex);
+		while (repl.shipping && LOAD(repl.state) == REPL_STREAMING)
+			pthread_cond_wait(&repl.idle, &repl.mutex);
+		STORE(repl.quit, 1);
+		pthread_cond_signal(&repl.wakeup);
+		pthread_mutex_unlock(&repl.mutex);
+
+		/* Connect to the thread, in case it is waiting for a follower */
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) {
+			connect(fd, (struct sockaddr*)&repl.address, sizeof(repl.address));
+			close(fd);
+		}
+	}
+	else {
+		STORE(repl.quit, 1); /* Not an error, see repl_follow_run */
+		shutdown(repl.socket, SHUT_RDWR); /* Wakes the thread from read */
+	}
+
+	pthread_join(repl.thread, NULL);
+	close(repl.socket);
+	if (repl.role == REPL_LEADER)
+		unlink(repl.address.sun_path);
+
+	pthread_cond_destroy(&repl.idle);
+	pthread_cond_destroy(&repl.wakeup);
+	pthread_mutex_destroy(&repl.mutex);
+	pthread_mutex_destroy(&repl.fs_mutex);
+	free(repl.buffers[0].data);
+	free(repl.buffers[1].data);
+	repl.role = REPL_NONE;
+}
+
+/* Returns 1 if this process is a leader, 0 otherwise. */
+int repl_leading(void) {
+	return repl.role == REPL_LEADER;
+}
+
+/*
+ * Returns 1 if this process is a follower, 0 otherwise. A follower whose
+ * leader is gone still is one, see repl_read_only.
+ */
+int repl_following(void) {
+	return repl.role == REPL_FOLLOWER;
+}
+
+/*
+ * Returns 1 if this process is a follower which doesn't take writes, because
+ * it is applying the leader's log or failed to, 0 otherwise. Must be called
+ * with the filesystem locked.
+ */
+int repl_read_only(void) {
+	return repl.role == REPL_FOLLOWER && repl.state != REPL_IDLE;
+}
+
+/*
+ * Keeps the replication thread off the filesystem until repl_unlock is called.
+ * Commands are executed between both calls.
+ */
+void repl_lock(void) {
+	if (repl.role != REPL_NONE)
+		pthread_mutex_lock(&repl.fs_mutex);
+}
+
+/* Lets the replication thread use the filesystem again. */
+void repl_unlock(void) {
+	if (repl.role != REPL_NONE)
+		pthread_mutex_unlock(&repl.fs_mutex);
+}
+
+/*
+ * Returns the front buffer, with room for a record of size bytes, handing it
+ * to the leader thread first if it is full.
+ */
+static struct repl_buffer* repl_front(int size) {
+	struct repl_buffer* front = &repl.buffers[repl.front];
+
+	if (front->length > 0 && front->length + size > front->capacity) {
+		repl_swap(1);
+		front = &repl.buffers[repl.front];
+	}
+	return front;
+}
+
+/*
+ * Logs a change to a path, which is either a set of length characters of value
+ * or, if value is NULL, a delete. time is the time of the filesystem before
+ * the change. Nothing is logged without a follower. Must be called with the
+ * filesystem locked. Returns 0 if the memory allocation failed, otherwise
+ * returns 1.
+ */
+static int repl_log(const struct path* path, const char* value, int length,
+					int time) {
+	const struct component* comp = path->components;
+	const struct component* end = comp + path->count;
+	int path_length = 0, size;
+	char* p;
+
+	if (LOAD(repl.state) != REPL_STREAMING)
+		return 1;
+
+	/* Paths are logged with a separator before each component */
+	for (; comp != end; ++comp)
+		path_length += comp->length + 1;
+	size = sizeof(struct repl_record) + path_length + length;
+
+	p = repl_add(repl_front(size), value == NULL ? REPL_DELETE : REPL_SET,
+				 time, path_length, value, length);
+	if (p == NULL)
+		return 0; /* Allocation failed */
+
+	for (comp = path->components; comp != end; ++comp) {
+		*p++ = '/';
+		memcpy(p, comp->start, comp->length);
+		p += comp->length;
+	}
+	++repl.count;
+	return 1;
+}
+
+/*
+ * Logs that length characters of value were set on a path, when the time of the
+ * filesystem was time (see repl_log).
+ */
+int repl_set(const struct path* path, const char* value, int length,
+			 int time) {
+	return repl_log(path, value, length, time);
+}
+
+/*
+ * Logs that a path was deleted, when the time of the filesystem was time (see
+ * repl_log).
+ */
+int repl_delete(const struct path* path, int time) {
+	return repl_log(path, NULL, 0, time);
+}
+
+/*
+ * Logs that every path with a value was deleted, when the time of the
+ * filesystem was time. The record has no path, and the value is logged with
+ * its terminator, so followers can use it in place. Must be called with the
+ * filesystem locked. Returns 0 if the memory allocation failed, otherwise
+ * returns 1.
+ */
+int repl_delete_value(const char* value, int time) {
+	int length = strlen(value) + 1;
+
+	if (LOAD(repl.state) != REPL_STREAMING)
+		return 1;
+	if (repl_add(repl_front(sizeof(struct repl_record) + length),
+				 REPL_DELETE_VALUE, time, 0, value, length) == NULL)
+		return 0; /* Allocation failed */
+	++repl.count;
+	return 1;
+}
+
+/*
+ * Hands the changes logged so far to the leader thread if it is idle, without
+ * waiting. Must be called with the filesystem locked.
+ */
+void repl_commit(void) {
+	if (repl.role == REPL_LEADER)
+		repl_swap(0);
+}
+
+/* Returns the number of changes logged by a leader or applied by a follower. */
+int repl_count(void) {
+	return repl.count > INT_MAX ? INT_MAX : (int)repl.count;
+}
+
+/*
+ * Returns the replication lag, in microseconds. On a leader, it is how long the
+ * oldest change not yet shipped has waited. On a follower, it is how long the
+ * oldest change in the last batch applied took to be applied since it was
+ * logged, or -1 once the follower stopped applying the log. Must be called
+ * with the filesystem locked.
+ */
+int repl_lag(void) {
+	struct repl_buffer* buffer = NULL;
+	unsigned long lag = 0;
+
+	if (repl.role == REPL_FOLLOWER && repl.state != REPL_STREAMING)
+		return -1; /* Disconnected */
+	if (repl.role == REPL_FOLLOWER)
+		lag = repl.lag;
+	else if (repl.role == REPL_LEADER) {
+		pthread_mutex_lock(&repl.mutex);
+		if (repl.shipping)
+			buffer = &repl.buffers[!repl.front];
+		else if (repl.buffers[repl.front].count > 0)
+			buffer = &repl.buffers[repl.front];
+		if (buffer != NULL)
+			lag = repl_elapsed(buffer->start.tv_sec, buffer->start.tv_nsec);
+		pthread_mutex_unlock(&repl.mutex);
+	}
+
+	lag /= 1000;
+	return lag > INT_MAX ? INT_MAX : (int)lag;
+}
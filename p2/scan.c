@@ -0,0 +1,308 @@
+/*
+ * File: 		scan.c
+ * Author: 		Ricardo Antunes
+ * Description: Splits instruction lines into the command, path components and
+ * 				value in a single pass, using SIMD instructions when available.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/* Character classes searched for by the scanner. */
+#define SCAN_SPACE 1	/* The characters in WHITESPACE_CHARS */
+#define SCAN_SLASH 2	/* The path separator */
+
+/*
+ * A block of characters, classified at once. Bit i of each mask is set if
+ * character start + i is in that class. Finding the next delimiter only loads
+ * a new block once the current one is used up, so each character is
+ * classified once per line.
+ */
+struct scan_block {
+	int start;				/* Index of the first character of the block */
+	int size;				/* Number of characters, less at the end */
+	unsigned int space;		/* Mask of whitespace characters */
+	unsigned int slash;		/* Mask of path separators */
+};
+
+/*
+ * Full blocks are classified with SIMD instructions when available. Only the
+ * characters in WHITESPACE_CHARS are treated as whitespace.
+ */
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define SCAN_BLOCK_SIZE 32
+#define SCAN_SIMD
+
+/* Classifies a full block of characters. */
+static void scan_classify(const char* s, struct scan_block* block) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)s);
+	__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+								_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+	block->space = (unsigned int)_mm256_movemask_epi8(m);
+	block->slash = (unsigned int)_mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SCAN_BLOCK_SIZE 16
+#define SCAN_SIMD
+
+/* Classifies a full block of characters. */
+static void scan_classify(const char* s, struct scan_block* block) {
+	__m128i v = _mm_loadu_si128((const __m128i*)s);
+	__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+							 _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	block->space = (unsigned int)_mm_movemask_epi8(m);
+	block->slash = (unsigned int)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+}
+
+#else
+
+#define SCAN_BLOCK_SIZE 32
+
+#endif
+
+/* Returns 1 if a character is whitespace, 0 otherwise. */
+static int scan_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ * Classifies the block which starts at s[i], with up to SCAN_BLOCK_SIZE
+ * characters before end. Nothing past end is ever read.
+ */
+static void scan_load(const char* s, int i, int end, struct scan_block* block) {
+	int j;
+
+	block->start = i;
+	block->size = end - i < SCAN_BLOCK_SIZE ? end - i : SCAN_BLOCK_SIZE;
+
+#ifdef SCAN_SIMD
+	if (block->size == SCAN_BLOCK_SIZE) {
+		scan_classify(s + i, block);
+		return;
+	}
+#endif
+
+	/* Partial blocks, or every block without SIMD, are classified by hand */
+	block->space = block->slash = 0;
+	for (j = 0; j < block->size; ++j) {
+		block->space |= (unsigned int)scan_is_space(s[i + j]) << j;
+		block->slash |= (unsigned int)(s[i + j] == '/') << j;
+	}
+}
+
+/*
+ * Returns the index of the first character of s, from i up to end, which is
+ * in class (if member is 1) or isn't (if member is 0). Returns end if there is
+ * no such character. The block passed is reused while i is inside it.
+ */
+static int scan_find(const char* s, int i, int end, struct scan_block* block,
+					 int class, int member) {
+	unsigned int mask, valid;
+
+	while (i < end) {
+		if (i < block->start || i >= block->start + block->size)
+			scan_load(s, i, end, block);
+
+		mask = ((class & SCAN_SPACE) ? block->space : 0) |
+			   ((class & SCAN_SLASH) ? block->slash : 0);
+		valid = block->size == 32 ? 0xFFFFFFFFu : (1u << block->size) - 1u;
+		mask = (member ? mask : ~mask) & valid;
+
+		if ((mask >>= i - block->start) != 0)
+			return i + __builtin_ctz(mask);
+		i = block->start + block->size;
+	}
+
+	return end;
+}
+
+/* Command names, indexed by command identifier. */
+static const char* const scan_command_names[UNKNOWN_ID] = {
+	QUIT_COMMAND, HELP_COMMAND, SET_COMMAND, PRINT_COMMAND, FIND_COMMAND,
+	LIST_COMMAND, SEARCH_COMMAND, SEARCHPREFIX_COMMAND, DELETE_COMMAND,
+	STATS_COMMAND, EXPORT_COMMAND, HASH_COMMAND, DIFF_COMMAND, DU_COMMAND,
+	COMPACT_COMMAND, DELETEVALUE_COMMAND, SEARCHIN_COMMAND
+};
+
+/*
+ * Gets the slot of a command name in the dispatch table from its length and
+ * its first and last characters, which is enough to tell every command apart.
+ */
+#define SCAN_SLOT(name, length) \
+	(((length) + 13 * (unsigned char)(name)[0] + \
+	  18 * (unsigned char)(name)[(length) - 1]) & (DISPATCH_TABLE_SIZE - 1))
+
+/* A slot of the dispatch table, empty if name is NULL. */
+struct scan_dispatch {
+	const char* name;	/* Command name */
+	int length;			/* Number of characters in name, 0 if empty */
+	int id;				/* Command identifier */
+};
+
+/* Maps command names to identifiers, filled by scan_init. */
+static struct scan_dispatch scan_dispatch_table[DISPATCH_TABLE_SIZE];
+
+/*
+ * Fills the command dispatch table. Returns 0 if two commands have the same
+ * slot, in which case SCAN_SLOT or DISPATCH_TABLE_SIZE must be changed.
+ * Otherwise returns 1.
+ */
+int scan_init(void) {
+	struct scan_dispatch* slot;
+	int id, length;
+
+	for (id = 0; id < UNKNOWN_ID; ++id) {
+		length = strlen(scan_command_names[id]);
+		slot = &scan_dispatch_table[SCAN_SLOT(scan_command_names[id], length)];
+		if (slot->name != NULL)
+			return 0; /* Slot already taken */
+
+		slot->name = scan_command_names[id];
+		slot->length = length;
+		slot->id = id;
+	}
+
+	return 1;
+}
+
+/* Returns the name of a command, or "?" if the identifier is unknown. */
+const char* scan_command_name(int id) {
+	return id >= 0 && id < UNKNOWN_ID ? scan_command_names[id] : "?";
+}
+
+/*
+ * Finds the identifier of a command name with length characters, which needs
+ * no terminator. Only the slot of the name is checked, so this takes the same
+ * time for every command.
+ */
+static int scan_command_id(const char* name, int length) {
+	const struct scan_dispatch* slot;
+
+	if (length == 0)
+		return UNKNOWN_ID;
+	slot = &scan_dispatch_table[SCAN_SLOT(name, length)];
+	if (slot->length != length || memcmp(slot->name, name, length) != 0)
+		return UNKNOWN_ID;
+	return slot->id;
+}
+
+/*
+ * Appends a component to a path, growing its array if needed. Returns 0 if the
+ * memory allocation failed, otherwise returns 1.
+ */
+static int scan_add_component(struct path* path, const char* start,
+							  int length) {
+	struct component* components, * comp;
+	unsigned int h = 0;
+	int i;
+
+	if (path->count == path->capacity) {
+		i = path->capacity == 0 ? 16 : path->capacity * 2;
+		components = realloc(path->components, i * sizeof(struct component));
+		if (components == NULL)
+			return 0; /* Allocation failed */
+		path->components = components;
+		path->capacity = i;
+	}
+
+	for (i = 0; i < length; ++i)
+		h = 31 * h + (unsigned char)start[i];
+
+	comp = &path->components[path->count++];
+	comp->start = start;
+	comp->length = length;
+	comp->hash = h;
+	return 1;
+}
+
+/*
+ * Splits the path which starts at s[i] into components, stopping at the first
+ * whitespace or at end. Returns the index where the path ends, or -1 if a
+ * memory allocation failed.
+ */
+static int scan_components(struct path* path, const char* s, int i, int end,
+						   struct scan_block* block) {
+	int j;
+
+	path->count = 0;
+	for (;;) {
+		i = scan_find(s, i, end, block, SCAN_SLASH, 0); /* Skip separators */
+		if (i == end || scan_is_space(s[i]))
+			return i;
+
+		j = scan_find(s, i, end, block, SCAN_SPACE | SCAN_SLASH, 1);
+		if (!scan_add_component(path, s + i, j - i))
+			return -1; /* Allocation failed */
+		i = j;
+	}
+}
+
+/*
+ * Splits a path string with length characters into components, without
+ * changing it. Returns 0 if a memory allocation failed, otherwise returns 1.
+ */
+int scan_path(struct path* path, const char* str, int length) {
+	struct scan_block block = { 0, 0, 0, 0 };
+
+	return scan_components(path, str, 0, length, &block) >= 0;
+}
+
+/*
+ * Splits an instruction line into the command, the components of its first
+ * argument and the value after it. The only change made to the line is a null
+ * character written after its last non whitespace character, which ends both
+ * the arguments and the value. Returns 0 if a memory allocation failed,
+ * otherwise returns 1.
+ */
+int scan_instruction(struct instruction* instruction, char* line) {
+	struct scan_block block = { 0, 0, 0, 0 };
+	int i, end = strlen(line);
+
+	/* Trailing whitespace is usually just the newline */
+	while (end > 0 && scan_is_space(line[end - 1]))
+		--end;
+	line[end] = '\0';
+
+	i = scan_find(line, 0, end, &block, SCAN_SPACE, 0);
+	instruction->command = line + i;
+	i = scan_find(line, i, end, &block, SCAN_SPACE, 1);
+	instruction->command_length = line + i - instruction->command;
+	instruction->command_id = scan_command_id(instruction->command,
+											  instruction->command_length);
+
+	i = scan_find(line, i, end, &block, SCAN_SPACE, 0);
+	instruction->args = line + i;
+	instruction->args_length = end - i;
+
+	i = scan_components(&instruction->path, line, i, end, &block);
+	if (i < 0)
+		return 0; /* Allocation failed */
+	i = scan_find(line, i, end, &block, SCAN_SPACE, 0);
+	instruction->value = line + i;
+	instruction->value_length = end - i;
+
+	return 1;
+}
+
+/* Frees the memory used by a path's components. */
+void scan_release(struct path* path) {
+	free(path->components);
+	path->components = NULL;
+	path->count = path->capacity = 0;
+}
@@ -0,0 +1,505 @@
+/*
+ * File: 		shard.c
+ * Author: 		Ricardo Antunes
+ * Description: Sharded filesystem, where the namespace is partitioned by the
+ * 				first path component and each partition is written by its own
+ * 				thread.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/*
+ * A set command waiting to be executed by a shard. Commands without a path
+ * free some of the files deleted on the shard (see filesystem_reclaim).
+ */
+struct command {
+	char* path;			/* Path, the value is stored in the same allocation */
+	int path_length;	/* Number of characters in the path */
+	char* value;		/* Value to set */
+	int value_length;	/* Number of characters in the value */
+	int time;			/* Time of the filesystem before the command runs */
+};
+
+/*
+ * Describes a shard. Each shard owns a filesystem with every path whose first
+ * component hashes to it, including its own value table and index. Commands
+ * are passed from the main thread through a single producer single consumer
+ * ring, so no locks are taken while the shard is busy.
+ */
+struct shard {
+	struct fs* fs;						/* Filesystem owned by this shard */
+	pthread_t thread;					/* Thread which executes commands */
+	struct command ring[SHARD_QUEUE_SIZE];	/* Queued commands */
+	unsigned int head;					/* Commands pushed, main thread only */
+	unsigned int tail;					/* Commands done, shard thread only */
+	int sleeping;						/* Set while the thread is waiting */
+	int quit;							/* Set when the thread must exit */
+	int failed;							/* Set if a memory allocation failed */
+	int backlog;						/* Deleted sub-trees not yet freed */
+	pthread_mutex_t mutex;				/* Protects the wakeup condition */
+	pthread_cond_t wakeup;				/* Signaled when a command is pushed */
+	struct path path;					/* Components of the current path */
+};
+
+/* Describes a sharded filesystem. */
+struct shards {
+	struct shard* shards;	/* Shards, each with its own thread */
+	int count;				/* Number of shards */
+	int time;				/* Times given to commands so far */
+};
+
+/*
+ * Gets the shard which owns a path, from the hash of its first component.
+ * Returns -1 if the path has no components (refers to the root).
+ */
+static int shards_hash(struct shards* shards, const struct path* path) {
+	if (path->count == 0)
+		return -1;
+	return path->components[0].hash % shards->count;
+}
+
+/*
+ * Fields shared between threads are accessed with sequentially consistent
+ * atomic builtins. A command is fully written before head moves past it, and
+ * its effects are visible to the main thread once tail moves past it.
+ */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+
+/* Waits until every command pushed to a shard has been executed. */
+static void shard_wait(struct shard* shard) {
+	while (LOAD(shard->tail) != shard->head)
+		sched_yield();
+}
+
+/* Waits until every shard has no commands left to execute. */
+static void shards_wait(struct shards* shards) {
+	int i;
+
+	for (i = 0; i < shards->count; ++i)
+		shard_wait(&shards->shards[i]);
+}
+
+/*
+ * Waits for a command to be pushed to a shard. Spins for a while before going
+ * to sleep, so that bursts of commands don't pay for a wakeup each. Returns 0
+ * if the thread must exit, otherwise returns 1.
+ */
+static int shard_pop_wait(struct shard* shard) {
+	int spin;
+
+	for (spin = 0; spin < SHARD_SPIN_COUNT; ++spin) {
+		if (shard->tail != LOAD(shard->head))
+			return 1;
+		if (LOAD(shard->quit))
+			return 0;
+		sched_yield();
+	}
+
+	/* Publish sleeping before reading head again, see shard_push */
+	pthread_mutex_lock(&shard->mutex);
+	STORE(shard->sleeping, 1);
+	while (shard->tail == LOAD(shard->head) && !LOAD(shard->quit))
+		pthread_cond_wait(&shard->wakeup, &shard->mutex);
+	STORE(shard->sleeping, 0);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return shard->tail != LOAD(shard->head);
+}
+
+/* Shard thread entry point, executes commands until told to quit. */
+static void* shard_run(void* shard_v) {
+	struct shard* shard = shard_v;
+	struct command* command;
+
+	while (shard_pop_wait(shard)) {
+		command = &shard->ring[shard->tail % SHARD_QUEUE_SIZE];
+
+		if (command->path == NULL) {
+			filesystem_reclaim(shard->fs, RECLAIM_BATCH_SIZE);
+			STORE(shard->backlog, filesystem_pending(shard->fs));
+		}
+		else {
+			filesystem_set_time(shard->fs, command->time);
+			if (!shard->failed &&
+				(!scan_path(&shard->path, command->path,
+							command->path_length) ||
+				 file_set(shard->fs, &shard->path, command->value,
+						  command->value_length) == NULL))
+				STORE(shard->failed, 1); /* Reported by the main thread */
+			free(command->path);
+		}
+
+		STORE(shard->tail, shard->tail + 1); /* Release the command */
+	}
+
+	return NULL;
+}
+
+/* Pushes a command to a shard, waiting if its ring is full. */
+static void shard_push(struct shard* shard, struct command* command) {
+	while (shard->head - LOAD(shard->tail) == SHARD_QUEUE_SIZE)
+		sched_yield();
+
+	shard->ring[shard->head % SHARD_QUEUE_SIZE] = *command;
+	STORE(shard->head, shard->head + 1); /* Publish the command */
+
+	/* Either the shard sees the new head or we see that it is sleeping */
+	if (LOAD(shard->sleeping)) {
+		pthread_mutex_lock(&shard->mutex);
+		pthread_cond_signal(&shard->wakeup);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+/* Stops a shard's thread and frees the memory associated with the shard. */
+static void shard_destroy(struct shard* shard) {
+	pthread_mutex_lock(&shard->mutex);
+	STORE(shard->quit, 1);
+	pthread_cond_signal(&shard->wakeup);
+	pthread_mutex_unlock(&shard->mutex);
+
+	pthread_join(shard->thread, NULL);
+	pthread_cond_destroy(&shard->wakeup);
+	pthread_mutex_destroy(&shard->mutex);
+	filesystem_destroy(shard->fs);
+	scan_release(&shard->path);
+}
+
+/*
+ * Creates a sharded filesystem with count shards and starts their threads.
+ * Returns NULL if the memory allocation failed.
+ */
+struct shards* shards_create(int count) {
+	struct shards* shards;
+	struct shard* shard;
+	int i;
+
+	if ((shards = calloc(1, sizeof(struct shards))) == NULL)
+		return NULL;
+	if ((shards->shards = calloc(count, sizeof(struct shard))) == NULL) {
+		free(shards); /* Allocation failed */
+		return NULL;
+	}
+
+	for (i = 0; i < count; ++i) {
+		shard = &shards->shards[i];
+		if ((shard->fs = filesystem_create()) == NULL)
+			break; /* Allocation failed */
+		pthread_mutex_init(&shard->mutex, NULL);
+		pthread_cond_init(&shard->wakeup, NULL);
+		if (pthread_create(&shard->thread, NULL, &shard_run, shard) != 0) {
+			pthread_cond_destroy(&shard->wakeup);
+			pthread_mutex_destroy(&shard->mutex);
+			filesystem_destroy(shard->fs);
+			break; /* Thread creation failed */
+		}
+		shards->count = i + 1;
+	}
+
+	if (shards->count != count) {
+		shards_destroy(shards);
+		return NULL;
+	}
+
+	return shards;
+}
+
+/* Stops every shard and frees all memory associated with them. */
+void shards_destroy(struct shards* shards) {
+	int i;
+
+	for (i = 0; i < shards->count; ++i)
+		shard_destroy(&shards->shards[i]);
+	free(shards->shards);
+	free(shards);
+}
+
+/*
+ * Queues a set command on the shard which owns the path. Each command is given
+ * a range of times as large as the number of components in the path, so that
+ * creation times stay globally ordered even though shards run in parallel.
+ * Returns 0 if a memory allocation failed, on this or any earlier command,
+ * otherwise returns 1.
+ */
+int shards_set(struct shards* shards, const struct path* path,
+			   const char* value, int length) {
+	const struct component* last;
+	struct command command;
+	int h = shards_hash(shards, path), i;
+
+	for (i = 0; i < shards->count; ++i)
+		if (LOAD(shards->shards[i].failed))
+			return 0; /* An earlier command failed */
+
+	/* The path is copied from its first to its last component */
+	command.path_length = 0;
+	if (h != -1) {
+		last = &path->components[path->count - 1];
+		command.path_length = last->start + last->length -
+							  path->components[0].start;
+	}
+	command.value_length = length;
+	if ((command.path = malloc(command.path_length + length + 1)) == NULL)
+		return 0; /* Allocation failed */
+	command.value = command.path + command.path_length;
+	if (h == -1)
+		h = 0; /* The root is kept by the first shard */
+	else
+		memcpy(command.path, path->components[0].start, command.path_length);
+	memcpy(command.value, value, length);
+	command.time = shards->time;
+	shards->time += path->count;
+
+	shard_push(&shards->shards[h], &command);
+	return 1;
+}
+
+/*
+ * Returns the filesystem which owns a path, after every command queued on it
+ * has been executed. The root belongs to every shard, so in that case all of
+ * them are waited for and the first one's filesystem is returned.
+ */
+struct fs* shards_route(struct shards* shards, const struct path* path) {
+	int h = shards_hash(shards, path);
+
+	if (h == -1) {
+		shards_wait(shards);
+		return shards->shards[0].fs;
+	}
+
+	shard_wait(&shards->shards[h]);
+	return shards->shards[h].fs;
+}
+
+/* Auxiliar function which counts the top-level files of a shard. */
+static void* shards_count_aux(void* count_v, struct file* file) {
+	(void)file; /* Supress unused parameter warning */
+	++*(int*)count_v;
+	return NULL;
+}
+
+/* Auxiliar function which collects the top-level files of a shard. */
+static void* shards_collect_aux(void* array_v, struct file* file) {
+	struct file*** array = array_v;
+
+	*(*array)++ = file;
+	return NULL;
+}
+
+/* Compares two top-level files by creation time. */
+static int shards_time_cmp(const void* lhs, const void* rhs) {
+	return file_time(*(struct file* const*)lhs) -
+		   file_time(*(struct file* const*)rhs);
+}
+
+/* Compares two top-level files lexicographically. */
+static int shards_component_cmp(const void* lhs, const void* rhs) {
+	return strcmp(file_component(*(struct file* const*)lhs),
+				  file_component(*(struct file* const*)rhs));
+}
+
+/*
+ * Collects the top-level files of every shard, sorted with cmp. Returns NULL
+ * if the memory allocation failed, otherwise the array must be freed by the
+ * caller. *count is set to the number of files.
+ */
+static struct file** shards_collect(struct shards* shards, int* count,
+									int (*cmp)(const void*, const void*)) {
+	struct file** files, ** end;
+	int i;
+
+	shards_wait(shards);
+
+	/* Count top-level files, so that the array is allocated only once */
+	*count = 0;
+	for (i = 0; i < shards->count; ++i)
+		file_traverse(filesystem_root(shards->shards[i].fs), count,
+					  &shards_count_aux);
+	if ((files = malloc((*count + 1) * sizeof(struct file*))) == NULL)
+		return NULL; /* Allocation failed */
+
+	end = files;
+	for (i = 0; i < shards->count; ++i)
+		file_traverse(filesystem_root(shards->shards[i].fs), &end,
+					  &shards_collect_aux);
+	qsort(files, *count, sizeof(struct file*), cmp);
+
+	return files;
+}
+
+/*
+ * Prints all paths and values, merging the shards by the creation time of their
+ * top-level files. Returns 0 if a memory allocation failed, otherwise 1.
+ */
+int shards_print(struct shards* shards) {
+	struct file** files;
+	int i, count;
+
+	if ((files = shards_collect(shards, &count, &shards_time_cmp)) == NULL)
+		return 0; /* Allocation failed */
+	for (i = 0; i < count; ++i)
+		file_print_tree(NULL, files[i]);
+	free(files);
+	return 1;
+}
+
+/*
+ * Prints the top-level components of every shard lexicographically. Returns 0
+ * if a memory allocation failed, otherwise 1.
+ */
+int shards_list(struct shards* shards) {
+	struct file** files;
+	int i, count;
+
+	if ((files = shards_collect(shards, &count, &shards_component_cmp)) == NULL)
+		return 0; /* Allocation failed */
+	for (i = 0; i < count; ++i)
+		output_puts(file_component(files[i]));
+	free(files);
+	return 1;
+}
+
+/*
+ * Collects the top-level files of every shard, sorted lexicographically.
+ * Returns NULL if the memory allocation failed, otherwise the array must be
+ * freed by the caller. *count is set to the number of files.
+ */
+struct file** shards_files(struct shards* shards, int* count) {
+	return shards_collect(shards, count, &shards_component_cmp);
+}
+
+/*
+ * Searches a file by value on every shard, returning the one which comes first
+ * in the print command. If no file is found, NULL is returned.
+ */
+struct file* shards_search(struct shards* shards, char* value) {
+	struct file* best = NULL, * file;
+	int i;
+
+	shards_wait(shards);
+	for (i = 0; i < shards->count; ++i) {
+		file = file_search(shards->shards[i].fs, value);
+		if (file != NULL && (best == NULL || file_compare(file, best) < 0))
+			best = file;
+	}
+
+	return best;
+}
+
+/*
+ * Appends every file whose value starts with prefix, on every shard, to the
+ * array *files (see file_search_prefix). Returns 0 if a memory allocation
+ * failed, otherwise returns 1.
+ */
+int shards_search_prefix(struct shards* shards, const char* prefix,
+						 struct file*** files, int* count) {
+	int i;
+
+	shards_wait(shards);
+	for (i = 0; i < shards->count; ++i)
+		if (!file_search_prefix(shards->shards[i].fs, prefix, files, count))
+			return 0; /* Allocation failed */
+
+	return 1;
+}
+
+/*
+ * Deletes a path and all paths beneath it, or every path except the root if
+ * path has no components. Returns 0 if the path wasn't found, otherwise
+ * returns 1.
+ */
+int shards_delete(struct shards* shards, const struct path* path) {
+	struct shard* shard;
+	struct file* file;
+	int h = shards_hash(shards, path), i;
+
+	if (h == -1) {
+		shards_wait(shards);
+		for (i = 0; i < shards->count; ++i) {
+			shard = &shards->shards[i];
+			file_delete(shard->fs, NULL);
+			STORE(shard->backlog, filesystem_pending(shard->fs));
+		}
+		return 1;
+	}
+
+	shard = &shards->shards[h];
+	shard_wait(shard);
+	if ((file = file_find(shard->fs, path)) == NULL)
+		return 0;
+	file_delete(shard->fs, file);
+	STORE(shard->backlog, filesystem_pending(shard->fs));
+	return 1;
+}
+
+/*
+ * Deletes every file with a value on every shard, with the paths beneath them
+ * (see file_delete_value). Returns the number of files deleted, not counting
+ * the ones beneath them, or -1 if a memory allocation failed.
+ */
+int shards_delete_value(struct shards* shards, const char* value) {
+	struct shard* shard;
+	int i, n, deleted = 0;
+
+	shards_wait(shards);
+	for (i = 0; i < shards->count; ++i) {
+		shard = &shards->shards[i];
+		if ((n = file_delete_value(shard->fs, value)) < 0)
+			return -1; /* Allocation failed */
+		deleted += n;
+		STORE(shard->backlog, filesystem_pending(shard->fs));
+	}
+
+	return deleted;
+}
+
+/*
+ * Asks every shard with deleted files left to free some of them, in the
+ * background, as filesystem_reclaim does between commands.
+ */
+void shards_reclaim(struct shards* shards) {
+	struct command command;
+	int i;
+
+	command.path = command.value = NULL;
+	command.time = 0;
+	for (i = 0; i < shards->count; ++i)
+		if (LOAD(shards->shards[i].backlog) > 0)
+			shard_push(&shards->shards[i], &command);
+}
+
+/*
+ * Returns the filesystem of the i-th shard, after every command queued on it
+ * has been executed. Returns NULL if there is no such shard.
+ */
+struct fs* shards_fs(struct shards* shards, int i) {
+	if (i < 0 || i >= shards->count)
+		return NULL;
+	shard_wait(&shards->shards[i]);
+	return shards->shards[i].fs;
+}
+
+/*
+ * Exports an image of every shard, merging them by the creation time of their
+ * top-level files. Returns 0 if the file couldn't be written or a memory
+ * allocation failed, otherwise returns 1.
+ */
+int shards_export(struct shards* shards, const char* filename) {
+	struct file** files;
+	int count, ok;
+
+	if ((files = shards_collect(shards, &count, &shards_time_cmp)) == NULL)
+		return 0; /* Allocation failed */
+	ok = image_export_files(filename, files, count);
+	free(files);
+	return ok;
+}
@@ -12,10 +12,13 @@
 
 /*
  * Describes an hash table used to search files by value, following the 
- * order shown in the print command (DFS, sorted by creation time).
+ * order shown in the print command (DFS, sorted by creation time). Files are
+ * inserted and removed with the lock of their bucket held, so concurrent
+ * writers may change the table, but searches take no locks.
  */
 struct table {
 	struct list* cells[HASH_TABLE_SIZE];
+	int locks[TABLE_LOCK_COUNT];	/* Locks shared by the buckets */
 };
 
 /*
@@ -24,19 +27,10 @@ struct table {
  */
 struct query_data {
 	const char* value;
+	unsigned int hash;
 	struct file* best;
 };
 
-/* Gets the hash of a string. */
-static int hash(const char* v) {
-	int h = 0, a = 127;
-
-	for (; *v != '\0'; ++v)
-		h = (a*h + *v) % HASH_TABLE_SIZE;
-		
-	return h;
-}
-
 /*
  * Creates a new hash table and returns a pointer to it. Returns NULL if memory
  * allocation fails.
@@ -62,13 +56,17 @@ void table_destroy(struct table* table) {
  * otherwise returns 1.
  */
 int table_insert(struct table* table, struct file* file) {
-	int h = hash(file_value(file));
+	int h = file_value_hash(file) % HASH_TABLE_SIZE, ok;
+	int* lock = &table->locks[h & (TABLE_LOCK_COUNT - 1)];
 
+	lock_acquire(lock);
 	if (table->cells[h] == NULL)
-		if ((table->cells[h] = list_create()) == NULL)
-			return 0; /* Allocation failed */
+		table->cells[h] = list_create();
+	ok = table->cells[h] != NULL &&
+		 list_insert(table->cells[h], file) != NULL;
+	lock_release(lock);
 
-	return list_insert(table->cells[h], file) != NULL;
+	return ok;
 }
 
 /*
@@ -78,55 +76,162 @@ int table_insert(struct table* table, struct file* file) {
 void table_remove(struct table* table, struct file* file) {
 	int h;
 
-	if (file_value(file) == NULL)
+	if (!file_has_value(file))
 		return;
 
-	h = hash(file_value(file));
+	h = file_value_hash(file) % HASH_TABLE_SIZE;
+	lock_acquire(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
 	if (table->cells[h] != NULL)
 		list_remove(table->cells[h], list_find(table->cells[h], file));
+	lock_release(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
 }
 
 /* Returns the better candidate out of the two files. */
 static struct file* best_file(struct file* lhs, struct file* rhs) {
-	struct file* lhs_p = lhs, * rhs_p = rhs;
-
-	if (lhs == NULL || lhs == rhs)
+	if (lhs == NULL)
 		return rhs;
 	if (rhs == NULL)
 		return lhs;
-
-	/* Put files on the same height */
-	while (file_height(lhs_p) > file_height(rhs_p))
-		lhs_p = file_parent(lhs_p);
-	while (file_height(rhs_p) > file_height(lhs_p))
-		rhs_p = file_parent(rhs_p);
-
-	/* Go down until the parent is the same but the file is not */
-	while (file_parent(lhs_p) != file_parent(rhs_p)) {
-		lhs_p = file_parent(lhs_p);
-		rhs_p = file_parent(rhs_p);
-	}
-
-	/* Compare creation time */
-	return file_time(lhs_p) < file_time(rhs_p) ? lhs : rhs;
+	return file_compare(lhs, rhs) <= 0 ? lhs : rhs;
 }
 
 /* Used to traverse a list in the table in order to find a file by value. */
 static void* table_list_traverse_aux(void* query_v, struct file* file) {
 	struct query_data* query = query_v;
 
-	if (strcmp(file_value(file), query->value) == 0)
+	/* Hashes are compared first, so values are only unpacked if they match */
+	if (file_value_hash(file) == query->hash &&
+		strcmp(file_value(file), query->value) == 0)
 		query->best = best_file(query->best, file);
 
 	return NULL; /* Never end the traversal early */ 
 }
 
+/* Data used to traverse the files in a list with a certain value. */
+struct traverse_data {
+	const char* value;
+	unsigned int hash;
+	void* ptr;
+	traverse_fn fn;
+};
+
+/* Used to traverse a list in the table, calling fn on files with a value. */
+static void* table_traverse_aux(void* data_v, struct file* file) {
+	struct traverse_data* data = data_v;
+
+	if (file_value_hash(file) == data->hash &&
+		strcmp(file_value(file), data->value) == 0)
+		return data->fn(data->ptr, file);
+	return NULL;
+}
+
+/*
+ * Traverses the files in the table with a certain value. fn(ptr, file) is
+ * called for each file, in no particular order. If fn(ptr, file) returns a
+ * non-NULL value, the traversal ends early and that value is returned.
+ * Otherwise, NULL is returned.
+ */
+void* table_traverse(struct table* table, const char* value, void* ptr,
+					 traverse_fn fn) {
+	struct traverse_data data;
+	int h;
+
+	data.value = value;
+	data.hash = value_hash(value);
+	data.ptr = ptr;
+	data.fn = fn;
+	h = data.hash % HASH_TABLE_SIZE;
+
+	if (table->cells[h] == NULL)
+		return NULL;
+	return list_traverse(table->cells[h], &data, &table_traverse_aux);
+}
+
+/* Used to remove the files in a list with the value traversed. */
+static void* table_match_aux(void* data_v, struct file* file) {
+	struct traverse_data* data = data_v;
+
+	if (file_value_hash(file) == data->hash &&
+		strcmp(file_value(file), data->value) == 0)
+		return file;
+	return NULL;
+}
+
+/*
+ * Removes every file with a certain value from the table, in a single pass
+ * over their bucket.
+ */
+void table_remove_value(struct table* table, const char* value) {
+	struct traverse_data data;
+	int h;
+
+	data.value = value;
+	data.hash = value_hash(value);
+	h = data.hash % HASH_TABLE_SIZE;
+
+	lock_acquire(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
+	if (table->cells[h] != NULL)
+		list_remove_if(table->cells[h], &data, &table_match_aux);
+	lock_release(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
+}
+
+/* Returns the bucket of a file with a value. */
+static int table_bucket(struct file* file) {
+	return file_value_hash(file) % HASH_TABLE_SIZE;
+}
+
+/*
+ * Compares two file pointers by bucket, then by hash so files with the same
+ * value are next to each other. Used by table_remove_deleted.
+ */
+static int table_bucket_cmp(const void* lhs_v, const void* rhs_v) {
+	struct file* lhs = *(struct file* const*)lhs_v;
+	struct file* rhs = *(struct file* const*)rhs_v;
+	unsigned long l = table_bucket(lhs), r = table_bucket(rhs);
+
+	if (l == r) {
+		l = file_value_hash(lhs);
+		r = file_value_hash(rhs);
+	}
+	return l < r ? -1 : l > r;
+}
+
+/* Used to remove the deleted files in a list, see file_alive. */
+static void* table_deleted_aux(void* unused, struct file* file) {
+	(void)unused; /* Supress unused parameter warning */
+	return file_alive(file) ? NULL : file;
+}
+
+/*
+ * Removes an array of deleted files with values from the table. The array is
+ * sorted by bucket, so each bucket is swept once, whatever the number of its
+ * files deleted.
+ */
+void table_remove_deleted(struct table* table, struct file** files,
+						  int count) {
+	int i, h;
+
+	qsort(files, count, sizeof(struct file*), &table_bucket_cmp);
+	for (i = 0; i < count; ++i) {
+		h = table_bucket(files[i]);
+		if ((i > 0 && h == table_bucket(files[i - 1])) ||
+			table->cells[h] == NULL)
+			continue; /* Bucket already swept */
+
+		lock_acquire(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
+		list_remove_if(table->cells[h], NULL, &table_deleted_aux);
+		lock_release(&table->locks[h & (TABLE_LOCK_COUNT - 1)]);
+	}
+}
+
 /* Searchs for a file in the table from its value. */
 struct file* table_search(struct table* table, const char* value) {
 	struct query_data query;
-	int h = hash(value);
+	int h;
 
 	query.value = value;
+	query.hash = value_hash(value);
+	h = query.hash % HASH_TABLE_SIZE;
 	query.best = NULL;
 
 	/* Find best file in the list */
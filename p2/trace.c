@@ -0,0 +1,303 @@
+/*
+ * File: 		trace.c
+ * Author: 		Ricardo Antunes
+ * Description: Binary trace of the commands executed, kept in a ring buffer
+ * 				and dumped to a file to find which commands caused latency
+ * 				spikes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/*
+ * A traced command. Every field is an unsigned int, so events are written to
+ * the trace file as they are kept in memory.
+ */
+struct trace_event {
+	unsigned int command;		/* Command identifier */
+	unsigned int depth;			/* Number of components in the path */
+	unsigned int value_length;	/* Length of the value, without whitespace */
+	unsigned int nodes;			/* Number of files touched */
+	unsigned int start_sec;		/* Start time, on the monotonic clock */
+	unsigned int start_nsec;
+	unsigned int end_sec;		/* End time, on the monotonic clock */
+	unsigned int end_nsec;
+};
+
+/* Header of a trace file, followed by its events from oldest to newest. */
+struct trace_header {
+	char magic[4];				/* TRACE_MAGIC */
+	unsigned int version;		/* TRACE_VERSION */
+	unsigned int count;			/* Number of events in the file */
+	unsigned int dropped;		/* Events overwritten before the dump */
+};
+
+/*
+ * Whether each command takes a path and a value, indexed by command identifier
+ * (the last one is for unknown commands).
+ */
+static const struct trace_command {
+	int path;
+	int value;
+} trace_commands[UNKNOWN_ID + 1] = {
+	{ 0, 0 },	/* QUIT_ID */
+	{ 0, 0 },	/* HELP_ID */
+	{ 1, 1 },	/* SET_ID */
+	{ 1, 0 },	/* PRINT_ID */
+	{ 1, 0 },	/* FIND_ID */
+	{ 1, 0 },	/* LIST_ID */
+	{ 0, 1 },	/* SEARCH_ID */
+	{ 0, 1 },	/* SEARCHPREFIX_ID */
+	{ 1, 0 },	/* DELETE_ID */
+	{ 0, 0 },	/* STATS_ID */
+	{ 0, 0 },	/* EXPORT_ID */
+	{ 1, 0 },	/* HASH_ID */
+	{ 0, 0 },	/* DIFF_ID */
+	{ 1, 0 },	/* DU_ID */
+	{ 0, 0 },	/* COMPACT_ID */
+	{ 0, 1 },	/* DELETEVALUE_ID */
+	{ 1, 1 },	/* SEARCHIN_ID */
+	{ 0, 0 }	/* UNKNOWN_ID */
+};
+
+/* Describes the trace. Events are written to events[total % size]. */
+struct trace {
+	struct trace_event* events;	/* Ring buffer, TRACE_RING_SIZE events */
+	unsigned int total;			/* Number of events ever recorded */
+	struct trace_event current;	/* Event of the command being executed */
+	const char* filename;		/* File where the trace is dumped */
+};
+
+/* There is a single command stream, so the trace state is kept here. */
+static struct trace trace;
+
+/* Set by the signal handler, the trace is dumped by trace_poll. */
+static volatile sig_atomic_t trace_requested;
+
+/* Signal handler which requests a dump. */
+static void trace_signal(int signal) {
+	(void)signal; /* Supress unused parameter warning */
+	trace_requested = 1;
+}
+
+/*
+ * Starts the trace, which is dumped to filename. If filename is NULL nothing
+ * is recorded, so commands don't pay for reading the clock. Returns 0 if the
+ * memory allocation failed, otherwise returns 1.
+ */
+int trace_create(const char* filename) {
+	struct sigaction action;
+
+	if (filename == NULL)
+		return 1; /* Tracing is off */
+
+	trace.events = malloc(TRACE_RING_SIZE * sizeof(struct trace_event));
+	if (trace.events == NULL)
+		return 0; /* Allocation failed */
+	trace.filename = filename;
+
+	/* SA_RESTART keeps the signal from interrupting reads from stdin */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &trace_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(TRACE_SIGNAL, &action, NULL);
+
+	return 1;
+}
+
+/* Stops the trace and frees its ring buffer, without dumping it. */
+void trace_destroy(void) {
+	if (trace.events != NULL)
+		signal(TRACE_SIGNAL, SIG_DFL);
+	free(trace.events);
+	trace.events = NULL;
+}
+
+/* Starts recording a command, which is about to be executed. */
+void trace_begin(const struct instruction* instruction) {
+	struct trace_event* event = &trace.current;
+	const struct trace_command* command;
+	struct timespec now;
+
+	if (trace.events == NULL)
+		return; /* Tracing is off */
+
+	command = &trace_commands[instruction->command_id];
+	event->command = instruction->command_id;
+
+	/* The value is the whole argument if the command takes no path */
+	event->depth = command->path ? instruction->path.count : 0;
+	if (!command->value)
+		event->value_length = 0;
+	else if (command->path)
+		event->value_length = instruction->value_length;
+	else
+		event->value_length = instruction->args_length;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	event->start_sec = now.tv_sec;
+	event->start_nsec = now.tv_nsec;
+}
+
+/*
+ * Ends recording the command started by trace_begin, which touched the number
+ * of files passed, and appends it to the ring buffer.
+ */
+void trace_end(int nodes) {
+	struct trace_event* event = &trace.current;
+	struct timespec now;
+
+	if (trace.events == NULL)
+		return; /* Tracing is off */
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	event->end_sec = now.tv_sec;
+	event->end_nsec = now.tv_nsec;
+	event->nodes = nodes;
+
+	trace.events[trace.total++ & (TRACE_RING_SIZE - 1)] = *event;
+}
+
+/*
+ * Dumps the ring buffer to the trace file, oldest events first. Returns 0 if
+ * the file couldn't be written, otherwise returns 1.
+ */
+int trace_dump(void) {
+	struct trace_header header;
+	unsigned int first, count, n;
+	FILE* stream;
+	int ok;
+
+	count = trace.total < TRACE_RING_SIZE ? trace.total : TRACE_RING_SIZE;
+	first = (trace.total - count) & (TRACE_RING_SIZE - 1);
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.count = count;
+	header.dropped = trace.total - count;
+
+	if ((stream = fopen(trace.filename, "wb")) == NULL)
+		return 0;
+
+	/* The oldest events may wrap around the end of the ring buffer */
+	n = TRACE_RING_SIZE - first < count ? TRACE_RING_SIZE - first : count;
+	ok = fwrite(&header, sizeof(header), 1, stream) == 1 &&
+		fwrite(trace.events + first, sizeof(struct trace_event), n,
+			   stream) == n &&
+		fwrite(trace.events, sizeof(struct trace_event), count - n,
+			   stream) == count - n;
+
+	return fclose(stream) == 0 && ok;
+}
+
+/* Dumps the trace if a dump was requested by a signal since the last call. */
+void trace_poll(void) {
+	if (trace_requested) {
+		trace_requested = 0;
+		trace_dump();
+	}
+}
+
+/* Returns the duration of an event in nanoseconds. */
+static unsigned long trace_duration(const struct trace_event* event) {
+	/* Unsigned arithmetic wraps, so the result holds if end_nsec is smaller */
+	return (event->end_sec - event->start_sec) * 1000000000ul +
+		   (unsigned long)event->end_nsec - event->start_nsec;
+}
+
+/* Compares two durations, used to sort them. */
+static int trace_duration_cmp(const void* lhs, const void* rhs) {
+	unsigned long l = *(const unsigned long*)lhs;
+	unsigned long r = *(const unsigned long*)rhs;
+	return l < r ? -1 : l > r;
+}
+
+/* Appends an unsigned number, in decimal, to the output. */
+static void trace_print_number(unsigned long value) {
+	char digits[24];
+
+	sprintf(digits, " %lu", value);
+	output_str(digits);
+}
+
+/*
+ * Prints the latency breakdown of a command, given the sorted durations of
+ * each of its events and the total number of files they touched.
+ */
+static void trace_print_command(const char* name, unsigned long* durations,
+								unsigned int count, unsigned long nodes) {
+	unsigned long total = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; ++i)
+		total += durations[i];
+
+	output_str(name);
+	trace_print_number(count);
+	trace_print_number(total / count);
+	trace_print_number(durations[count / 2]);
+	trace_print_number(durations[count - 1 - count / 100]);
+	trace_print_number(durations[count - 1]);
+	trace_print_number(nodes / count);
+	output_char('\n');
+}
+
+/*
+ * Prints the latency breakdown by command of a trace file: the number of
+ * events, the mean, median, 99th percentile and maximum durations in
+ * nanoseconds and the mean number of files touched. Returns 0 if the file
+ * couldn't be read or a memory allocation failed, otherwise returns 1.
+ */
+int trace_decode(const char* filename) {
+	struct trace_header header;
+	struct trace_event* events = NULL;
+	unsigned long* durations = NULL, nodes;
+	unsigned int i, count;
+	FILE* stream;
+	int command, ok;
+
+	if ((stream = fopen(filename, "rb")) == NULL)
+		return 0;
+	ok = fread(&header, sizeof(header), 1, stream) == 1 &&
+		 memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0 &&
+		 header.version == TRACE_VERSION &&
+		 (events = malloc((header.count + 1) *
+						  sizeof(struct trace_event))) != NULL &&
+		 (durations = malloc((header.count + 1) *
+							 sizeof(unsigned long))) != NULL &&
+		 fread(events, sizeof(struct trace_event), header.count,
+			   stream) == header.count;
+	fclose(stream);
+
+	if (ok) {
+		output_puts(TRACE_COLUMNS);
+		for (command = 0; command <= UNKNOWN_ID; ++command) {
+			count = 0;
+			nodes = 0;
+			for (i = 0; i < header.count; ++i)
+				if (events[i].command == (unsigned int)command) {
+					durations[count++] = trace_duration(&events[i]);
+					nodes += events[i].nodes;
+				}
+			if (count == 0)
+				continue;
+
+			qsort(durations, count, sizeof(unsigned long),
+				  &trace_duration_cmp);
+			trace_print_command(scan_command_name(command), durations,
+								count, nodes);
+		}
+	}
+
+	free(events);
+	free(durations);
+	return ok;
+}
@@ -0,0 +1,239 @@
+/*
+ * File: 		value.c
+ * Author: 		Ricardo Antunes
+ * Description: Packs long values with a small LZ77 codec, so that long and
+ * 				repetitive values take less memory, and unpacks them when they
+ * 				are read.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adt.h"
+
+/*
+ * A packed value starts with the length of the unpacked value in two bytes,
+ * followed by sequences of a token, literals and a match. The high nibble of
+ * the token is the number of literals, and the low nibble is the length of
+ * the match minus VALUE_MIN_MATCH. A nibble of 15 is continued by the bytes
+ * after it, which are added to it up to the first one below 255. Each match
+ * is copied from an offset, in two bytes, behind the end of the literals. The
+ * last sequence ends the value and has no match.
+ */
+#define VALUE_MIN_MATCH 4		/* Shortest match worth coding */
+#define VALUE_MAX_LENGTH 65535	/* Longest value which can be packed */
+#define VALUE_HASH_BITS 12		/* Size of the match finder's table */
+
+/*
+ * Values are unpacked into a buffer of the thread reading them, so each shard
+ * can read its own values at the same time.
+ */
+static __thread char value_buffer[VALUE_MAX_LENGTH + 1];
+
+/* Hashes the VALUE_MIN_MATCH characters at s, to find earlier matches. */
+static unsigned int value_hash_match(const unsigned char* s) {
+	unsigned int x = s[0] | s[1] << 8 | s[2] << 16 | (unsigned int)s[3] << 24;
+	return (x * 2654435761u) >> (32 - VALUE_HASH_BITS) &
+		   ((1u << VALUE_HASH_BITS) - 1);
+}
+
+/*
+ * Appends the continuation bytes of a nibble which was 15, where n is the rest
+ * of the count. Returns NULL if there is no room before end, otherwise returns
+ * the new end of the output.
+ */
+static unsigned char* value_extend(unsigned char* out, unsigned char* end,
+								   int n) {
+	for (; n >= 255; n -= 255) {
+		if (out == end)
+			return NULL;
+		*out++ = 255;
+	}
+	if (out == end)
+		return NULL;
+	*out++ = n;
+	return out;
+}
+
+/*
+ * Appends a sequence of count literals and a match with length characters at
+ * offset, or no match if offset is 0. Returns NULL if there is no room before
+ * end, otherwise returns the new end of the output.
+ */
+static unsigned char* value_sequence(unsigned char* out, unsigned char* end,
+									 const unsigned char* literals, int count,
+									 int offset, int length) {
+	int match = offset != 0 ? length - VALUE_MIN_MATCH : 0;
+
+	if (out == end)
+		return NULL;
+	*out++ = (count < 15 ? count : 15) << 4 | (match < 15 ? match : 15);
+	if (count >= 15 && (out = value_extend(out, end, count - 15)) == NULL)
+		return NULL;
+	if (end - out < count)
+		return NULL;
+	memcpy(out, literals, count);
+	out += count;
+
+	if (offset == 0)
+		return out; /* Last sequence */
+	if (end - out < 2)
+		return NULL;
+	*out++ = offset & 0xFF;
+	*out++ = offset >> 8;
+	if (match >= 15 && (out = value_extend(out, end, match - 15)) == NULL)
+		return NULL;
+	return out;
+}
+
+/*
+ * Packs the first length characters of value, and stores the number of bytes
+ * used in *size. Returns NULL if the packed value wouldn't be shorter than the
+ * value, or if the memory allocation failed, in which case the value should be
+ * kept as it is. Otherwise returns the packed value, which must be freed.
+ */
+char* value_pack(const char* value, int length, int* size) {
+	const unsigned char* in = (const unsigned char*)value;
+	unsigned short last[1 << VALUE_HASH_BITS]; /* Last position + 1, by hash */
+	unsigned char* packed, * out, * end;
+	int i = 0, start = 0, match, n;
+	unsigned int h;
+
+	if (length <= VALUE_MIN_MATCH || length > VALUE_MAX_LENGTH)
+		return NULL;
+	if ((packed = malloc(length)) == NULL)
+		return NULL; /* Allocation failed */
+	end = packed + length; /* With the terminator, the value takes length + 1 */
+	packed[0] = length & 0xFF;
+	packed[1] = length >> 8;
+	out = packed + 2;
+	memset(last, 0, sizeof(last));
+
+	/* Find the latest earlier match of each position, greedily */
+	while (out != NULL && i + VALUE_MIN_MATCH <= length) {
+		h = value_hash_match(in + i);
+		match = last[h] - 1;
+		last[h] = i + 1;
+		if (match < 0 || memcmp(in + match, in + i, VALUE_MIN_MATCH) != 0) {
+			++i;
+			continue;
+		}
+
+		for (n = VALUE_MIN_MATCH; i + n < length && in[match + n] == in[i + n];
+			 ++n)
+			continue;
+		out = value_sequence(out, end, in + start, i - start, i - match, n);
+		i += n;
+		start = i;
+	}
+
+	if (out == NULL ||
+		(out = value_sequence(out, end, in + start, length - start, 0, 0)) ==
+		NULL) {
+		free(packed); /* Not worth packing */
+		return NULL;
+	}
+
+	*size = out - packed;
+	if ((out = realloc(packed, *size)) != NULL)
+		packed = out; /* Shrinking may fail, but the value is still valid */
+	return (char*)packed;
+}
+
+/* Reads the continuation bytes of a nibble which was 15. */
+static int value_count(const unsigned char** in) {
+	int n = 0;
+
+	while (**in == 255) {
+		n += 255;
+		++*in;
+	}
+	return n + *(*in)++;
+}
+
+/*
+ * Unpacks a value packed by value_pack. Returns a pointer to the value, which
+ * is overwritten by the next value unpacked on the calling thread.
+ */
+const char* value_unpack(const char* packed) {
+	const unsigned char* in = (const unsigned char*)packed;
+	char* out = value_buffer, * end;
+	int count, offset, token, n;
+
+	end = out + (in[0] | in[1] << 8);
+	in += 2;
+
+	for (;;) {
+		token = *in++;
+		if ((count = token >> 4) == 15)
+			count += value_count(&in);
+		memcpy(out, in, count);
+		out += count;
+		in += count;
+		if (out == end)
+			break; /* Last sequence */
+
+		offset = in[0] | in[1] << 8;
+		in += 2;
+		if ((count = token & 15) == 15)
+			count += value_count(&in);
+
+		/* Matches may overlap the characters they produce */
+		count += VALUE_MIN_MATCH;
+		if (offset >= count)
+			memcpy(out, out - offset, count);
+		else
+			for (n = 0; n < count; ++n)
+				out[n] = out[n - offset];
+		out += count;
+	}
+
+	*end = '\0';
+	return value_buffer;
+}
+
+/*
+ * Returns the number of bytes saved by keeping a value packed, instead of as
+ * it is, with its terminator.
+ */
+int value_saved(const char* packed) {
+	const unsigned char* in = (const unsigned char*)packed;
+	int length = in[0] | in[1] << 8, n = 0, count, token;
+
+	/* Walk the sequences up to the end of the value, without unpacking it */
+	in += 2;
+	for (;;) {
+		token = *in++;
+		if ((count = token >> 4) == 15)
+			count += value_count(&in);
+		in += count;
+		if ((n += count) == length)
+			break; /* Last sequence */
+
+		in += 2; /* Offset */
+		if ((count = token & 15) == 15)
+			count += value_count(&in);
+		n += count + VALUE_MIN_MATCH;
+	}
+
+	return length + 1 - (in - (const unsigned char*)packed);
+}
+
+/* Returns the number of bytes taken by a packed value. */
+int value_size(const char* packed) {
+	const unsigned char* in = (const unsigned char*)packed;
+
+	return (in[0] | in[1] << 8) + 1 - value_saved(packed);
+}
+
+/*
+ * Hashes a value (FNV-1a). Values are searched by this hash, so searches never
+ * need to unpack values which don't match.
+ */
+unsigned int value_hash(const char* value) {
+	unsigned int h = 2166136261u;
+
+	for (; *value != '\0'; ++value)
+		h = (h ^ (unsigned char)*value) * 16777619u;
+	return h;
+}
@@ -0,0 +1,246 @@
+/*
+ * File: 		writer.c
+ * Author: 		Ricardo Antunes
+ * Description: Concurrent writers, threads which set values on a single
+ * 				shared filesystem, locking only the directories they change.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "adt.h"
+
+/* A set command waiting to be executed by a writer. */
+struct write {
+	char* path;			/* Path, the value is stored in the same allocation */
+	int path_length;	/* Number of characters in the path */
+	char* value;		/* Value to set */
+	int value_length;	/* Number of characters in the value */
+};
+
+/*
+ * Describes a writer. Unlike shards, every writer changes the same filesystem,
+ * so any path may be given to any writer, but commands are still passed from
+ * the main thread through a single producer single consumer ring.
+ */
+struct writer {
+	struct fs* fs;						/* Filesystem shared by every writer */
+	pthread_t thread;					/* Thread which executes commands */
+	struct write ring[SHARD_QUEUE_SIZE];	/* Queued commands */
+	unsigned int head;					/* Commands pushed, main thread only */
+	unsigned int tail;					/* Commands done, writer thread only */
+	int sleeping;						/* Set while the thread is waiting */
+	int quit;							/* Set when the thread must exit */
+	int failed;							/* Set if a memory allocation failed */
+	pthread_mutex_t mutex;				/* Protects the wakeup condition */
+	pthread_cond_t wakeup;				/* Signaled when a command is pushed */
+	struct path path;					/* Components of the current path */
+};
+
+/* Describes the writers of a filesystem. */
+struct writers {
+	struct fs* fs;				/* Filesystem shared by every writer */
+	struct writer* writers;		/* Writers, each with its own thread */
+	int count;					/* Number of writers */
+};
+
+/* See shard.c, the ring is used the same way. */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+
+/*
+ * Gets the writer of a path, from the hashes of all its components. Sets on
+ * the same path always go to the same writer, so they are executed in order.
+ */
+static int writers_hash(struct writers* writers, const struct path* path) {
+	unsigned int h = 0;
+	int i;
+
+	for (i = 0; i < path->count; ++i)
+		h = h * 31 + path->components[i].hash;
+	return h % writers->count;
+}
+
+/*
+ * Waits for a command to be pushed to a writer. Spins for a while before going
+ * to sleep, see shard.c. Returns 0 if the thread must exit, otherwise returns
+ * 1.
+ */
+static int writer_pop_wait(struct writer* writer) {
+	int spin;
+
+	for (spin = 0; spin < SHARD_SPIN_COUNT; ++spin) {
+		if (writer->tail != LOAD(writer->head))
+			return 1;
+		if (LOAD(writer->quit))
+			return 0;
+		sched_yield();
+	}
+
+	/* Publish sleeping before reading head again, see writer_push */
+	pthread_mutex_lock(&writer->mutex);
+	STORE(writer->sleeping, 1);
+	while (writer->tail == LOAD(writer->head) && !LOAD(writer->quit))
+		pthread_cond_wait(&writer->wakeup, &writer->mutex);
+	STORE(writer->sleeping, 0);
+	pthread_mutex_unlock(&writer->mutex);
+
+	return writer->tail != LOAD(writer->head);
+}
+
+/* Writer thread entry point, executes commands until told to quit. */
+static void* writer_run(void* writer_v) {
+	struct writer* writer = writer_v;
+	struct write* command;
+
+	while (writer_pop_wait(writer)) {
+		command = &writer->ring[writer->tail % SHARD_QUEUE_SIZE];
+		if (!writer->failed &&
+			(!scan_path(&writer->path, command->path, command->path_length) ||
+			 file_set(writer->fs, &writer->path, command->value,
+					  command->value_length) == NULL))
+			STORE(writer->failed, 1); /* Reported by the main thread */
+		free(command->path);
+		STORE(writer->tail, writer->tail + 1); /* Release the command */
+	}
+
+	return NULL;
+}
+
+/* Pushes a command to a writer, waiting if its ring is full. */
+static void writer_push(struct writer* writer, struct write* command) {
+	while (writer->head - LOAD(writer->tail) == SHARD_QUEUE_SIZE)
+		sched_yield();
+
+	writer->ring[writer->head % SHARD_QUEUE_SIZE] = *command;
+	STORE(writer->head, writer->head + 1); /* Publish the command */
+
+	/* Either the writer sees the new head or we see that it is sleeping */
+	if (LOAD(writer->sleeping)) {
+		pthread_mutex_lock(&writer->mutex);
+		pthread_cond_signal(&writer->wakeup);
+		pthread_mutex_unlock(&writer->mutex);
+	}
+}
+
+/* Stops a writer's thread and frees the memory associated with it. */
+static void writer_destroy(struct writer* writer) {
+	pthread_mutex_lock(&writer->mutex);
+	STORE(writer->quit, 1);
+	pthread_cond_signal(&writer->wakeup);
+	pthread_mutex_unlock(&writer->mutex);
+
+	pthread_join(writer->thread, NULL);
+	pthread_cond_destroy(&writer->wakeup);
+	pthread_mutex_destroy(&writer->mutex);
+	scan_release(&writer->path);
+}
+
+/*
+ * Creates count writers of a filesystem and starts their threads. Nothing else
+ * may change the filesystem until they are destroyed, and it may only be read
+ * after writers_wait. Returns NULL if the memory allocation failed.
+ */
+struct writers* writers_create(struct fs* fs, int count) {
+	struct writers* writers;
+	struct writer* writer;
+	int i;
+
+	if ((writers = calloc(1, sizeof(struct writers))) == NULL)
+		return NULL;
+	if ((writers->writers = calloc(count, sizeof(struct writer))) == NULL) {
+		free(writers); /* Allocation failed */
+		return NULL;
+	}
+
+	writers->fs = fs;
+	filesystem_set_shared(fs, 1);
+	for (i = 0; i < count; ++i) {
+		writer = &writers->writers[i];
+		writer->fs = fs;
+		pthread_mutex_init(&writer->mutex, NULL);
+		pthread_cond_init(&writer->wakeup, NULL);
+		if (pthread_create(&writer->thread, NULL, &writer_run, writer) != 0) {
+			pthread_cond_destroy(&writer->wakeup);
+			pthread_mutex_destroy(&writer->mutex);
+			break; /* Thread creation failed */
+		}
+		writers->count = i + 1;
+	}
+
+	if (writers->count != count) {
+		writers_destroy(writers);
+		return NULL;
+	}
+
+	return writers;
+}
+
+/*
+ * Stops every writer, once their commands have been executed, and frees all
+ * memory associated with them. The filesystem is left as it is.
+ */
+void writers_destroy(struct writers* writers) {
+	int i;
+
+	writers_wait(writers);
+	for (i = 0; i < writers->count; ++i)
+		writer_destroy(&writers->writers[i]);
+	filesystem_set_shared(writers->fs, 0);
+	free(writers->writers);
+	free(writers);
+}
+
+/*
+ * Queues a set command on the writer of its path. Writers run in parallel, so
+ * files created by concurrent sets get their times in the order they were
+ * actually created, which may not be the order of the commands. Returns 0 if a
+ * memory allocation failed, on this or any earlier command, otherwise returns
+ * 1.
+ */
+int writers_set(struct writers* writers, const struct path* path,
+				const char* value, int length) {
+	const struct component* last;
+	struct write command;
+	int i;
+
+	for (i = 0; i < writers->count; ++i)
+		if (LOAD(writers->writers[i].failed))
+			return 0; /* An earlier command failed */
+
+	/* The path is copied from its first to its last component */
+	command.path_length = 0;
+	if (path->count > 0) {
+		last = &path->components[path->count - 1];
+		command.path_length = last->start + last->length -
+							  path->components[0].start;
+	}
+	command.value_length = length;
+	if ((command.path = malloc(command.path_length + length + 1)) == NULL)
+		return 0; /* Allocation failed */
+	command.value = command.path + command.path_length;
+	if (path->count > 0)
+		memcpy(command.path, path->components[0].start, command.path_length);
+	memcpy(command.value, value, length);
+
+	writer_push(&writers->writers[writers_hash(writers, path)], &command);
+	return 1;
+}
+
+/*
+ * Waits until every writer has executed its commands, and brings the
+ * filesystem's digests up to date, so that it may be read.
+ */
+void writers_wait(struct writers* writers) {
+	int i;
+
+	for (i = 0; i < writers->count; ++i)
+		while (LOAD(writers->writers[i].tail) != writers->writers[i].head)
+			sched_yield();
+	filesystem_settle(writers->fs);
+}